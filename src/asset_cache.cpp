@@ -0,0 +1,256 @@
+#include "asset_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char magic[8] = {'V', 'B', 'G', 'A', 'S', 'S', 'E', 'T'};
+constexpr uint32_t version = 1;
+constexpr uint32_t format_ayuv = 1;
+
+// Entry file: this header, the image and the blurred image
+struct entry_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;
+  int32_t width;
+  int32_t height;
+  float sigma;
+  uint32_t reserved;
+};
+
+// FNV-1a, 64 bit
+struct hasher {
+  uint64_t hash = 14695981039346656037ull;
+
+  void add(const void *data, size_t size) {
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+  template <typename T>
+  void add(const T &value) {
+    add(&value, sizeof(value));
+  }
+};
+
+std::string hex(uint64_t hash) {
+  char name[17];
+  snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+  return name;
+}
+
+}  // namespace
+
+asset make_asset(std::vector<uint8_t> pixels) {
+  auto owner = std::make_shared<std::vector<uint8_t>>(std::move(pixels));
+  return asset(owner, owner->data());
+}
+
+asset_cache::asset_cache(std::string dir, uint64_t max_bytes) : dir_(std::move(dir)), max_bytes_(max_bytes) {
+  if (dir_.empty()) {
+    return;
+  }
+  std::error_code error;
+  std::filesystem::create_directories(dir_, error);
+  if (error) {
+    std::cout << "Warning: background cache disabled, cannot create " << dir_ << ": " << error.message() << std::endl;
+    dir_.clear();
+  }
+}
+
+std::string asset_cache::default_dir() {
+  if (const char *cache = std::getenv("XDG_CACHE_HOME")) {
+    return std::string(cache) + "/webcamvb";
+  }
+  if (const char *home = std::getenv("HOME")) {
+    return std::string(home) + "/.cache/webcamvb";
+  }
+  return "";
+}
+
+std::string asset_cache::entry(const std::string &source, int w, int h, float sigma) const {
+  if (dir_.empty()) {
+    return "";
+  }
+  std::error_code error;
+  const auto path = std::filesystem::absolute(source, error);
+  const auto size = std::filesystem::file_size(source, error);
+  if (error) {
+    return "";
+  }
+  const auto modified = std::filesystem::last_write_time(source, error);
+  const auto settings = [&](hasher &key) {
+    key.add(version);
+    key.add(format_ayuv);
+    key.add(w);
+    key.add(h);
+    key.add(sigma);
+  };
+
+  // known file: the link leads to its entry without reading it
+  hasher file_key;
+  file_key.add(path.native().data(), path.native().size());
+  file_key.add(uint64_t(size));
+  file_key.add(error ? int64_t(0) : int64_t(modified.time_since_epoch().count()));
+  settings(file_key);
+  const std::string link = dir_ + "/" + hex(file_key.hash) + ".link";
+  const auto target = std::filesystem::read_symlink(link, error);
+  if (!error && std::filesystem::exists(dir_ + "/" + target.string(), error)) {
+    return dir_ + "/" + target.string();
+  }
+
+  // new or changed file: the entry follows from the contents, the same image elsewhere shares it
+  std::ifstream file(source, std::ios::binary);
+  if (!file.good()) {
+    return "";
+  }
+  hasher key;
+  std::vector<char> chunk(1 << 16);
+  while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0) {
+    key.add(chunk.data(), size_t(file.gcount()));
+  }
+  settings(key);
+  const std::string name = hex(key.hash) + ".ayuv";
+  std::filesystem::remove(link, error);
+  std::filesystem::create_symlink(name, link, error);
+  return dir_ + "/" + name;
+}
+
+bool asset_cache::load(const std::string &entry, int w, int h, float sigma, background_assets &out) const {
+  if (entry.empty()) {
+    return false;
+  }
+  const int fd = open(entry.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  const size_t image_size = size_t(w) * h * 4;
+  const size_t size = sizeof(entry_header) + 2 * image_size;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) != size) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the modification time tells trim() when the entry was used last
+  futimens(fd, nullptr);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  std::shared_ptr<void> mapping(data, [size](void *p) {
+    munmap(p, size);
+  });
+
+  entry_header header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+      header.format != format_ayuv || header.width != w || header.height != h || header.sigma != sigma) {
+    return false;
+  }
+  const auto *pixels = static_cast<const uint8_t *>(data) + sizeof(entry_header);
+  out.image = asset(mapping, pixels);
+  out.blurred = asset(mapping, pixels + image_size);
+  return true;
+}
+
+void asset_cache::store(const std::string &entry, int w, int h, float sigma, const background_assets &assets) const {
+  if (entry.empty() || !assets.image || !assets.blurred) {
+    return;
+  }
+  entry_header header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.format = format_ayuv;
+  header.width = w;
+  header.height = h;
+  header.sigma = sigma;
+
+  // written next to the entry and renamed, so a load never sees half an entry
+  const std::string temp =
+      entry + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+  const size_t image_size = size_t(w) * h * 4;
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(assets.image.get()), image_size);
+    file.write(reinterpret_cast<const char *>(assets.blurred.get()), image_size);
+    file.close();
+    if (file.fail()) {
+      std::cout << "Warning: could not write background cache entry " << temp << std::endl;
+      std::remove(temp.c_str());
+      return;
+    }
+  }
+  if (std::rename(temp.c_str(), entry.c_str()) != 0) {
+    std::remove(temp.c_str());
+  }
+  trim();
+}
+
+void asset_cache::trim() const {
+  struct cached {
+    std::filesystem::path path;
+    std::filesystem::file_time_type used;
+    uint64_t size;
+  };
+  std::vector<cached> entries;
+  std::vector<std::filesystem::path> links;
+  uint64_t total = 0;
+  std::error_code error;
+  // a store() that has not renamed its file after this long crashed, and left the file behind
+  const auto stale = std::filesystem::file_time_type::clock::now() - std::chrono::minutes(10);
+  for (const auto &file : std::filesystem::directory_iterator(dir_, error)) {
+    const auto extension = file.path().extension();
+    if (extension == ".link") {
+      links.push_back(file.path());
+    } else if (extension == ".tmp") {
+      std::error_code file_error;
+      const auto written = file.last_write_time(file_error);
+      const uint64_t size = file.file_size(file_error);
+      if (file_error) {
+        continue;
+      }
+      if (written < stale && std::filesystem::remove(file.path(), file_error)) {
+        continue;
+      }
+      total += size;
+    } else if (extension == ".ayuv") {
+      std::error_code file_error;
+      cached entry{file.path(), file.last_write_time(file_error), file.file_size(file_error)};
+      if (!file_error) {
+        entries.push_back(entry);
+        total += entry.size;
+      }
+    }
+  }
+  // least recently used first
+  std::sort(entries.begin(), entries.end(), [](const cached &a, const cached &b) {
+    return a.used < b.used;
+  });
+  for (const cached &entry : entries) {
+    if (total <= max_bytes_) {
+      break;
+    }
+    if (std::filesystem::remove(entry.path, error)) total -= entry.size;
+  }
+  for (const auto &link : links) {
+    if (!std::filesystem::exists(link, error)) std::filesystem::remove(link, error);
+  }
+}
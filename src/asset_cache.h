@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Pixels of a background, owned or mapped from the asset cache. Immutable, shared by the configs and streams using it.
+using asset = std::shared_ptr<const uint8_t>;
+
+asset make_asset(std::vector<uint8_t> pixels);
+
+// A background ready to composite (AYUV, w x h), as it is and blurred for virtual_background_blurred
+struct background_assets {
+  asset image;
+  asset blurred;
+};
+
+// On-disk cache of converted backgrounds, so that selecting a background again, or starting again, maps a file instead
+// of decoding, scaling, converting and blurring the image. Entries are named after a hash of the source contents and of
+// everything the conversion depends on: frame size, pixel format and blur sigma. A changed source or setting gives a
+// new entry. Finding an entry does not read the source: a link named after its path, size and modification time points
+// to the entry, only without one (a new or changed file) the contents are hashed.
+//
+// The cache is kept under `max_bytes`: every store removes the least recently used entries beyond it (loads mark an
+// entry as used), and links whose entry is gone.
+class asset_cache {
+private:
+  std::string dir_;
+  uint64_t max_bytes_;
+
+public:
+  // Caching is off with an empty directory, or when the directory cannot be created
+  explicit asset_cache(std::string dir, uint64_t max_bytes = uint64_t(256) << 20);
+
+  // $XDG_CACHE_HOME/webcamvb, or ~/.cache/webcamvb
+  static std::string default_dir();
+
+  // Path of the entry for `source` converted to w x h and blurred with `sigma`, empty when caching is off or the
+  // source cannot be read
+  std::string entry(const std::string &source, int w, int h, float sigma) const;
+
+  // Maps an entry, false when it is not there (or not usable)
+  bool load(const std::string &entry, int w, int h, float sigma, background_assets &out) const;
+
+  // Writes an entry, failures only cost the next load a conversion
+  void store(const std::string &entry, int w, int h, float sigma, const background_assets &assets) const;
+
+private:
+  // Removes the least recently used entries beyond max_bytes, links to removed entries and files left by crashed stores
+  void trim() const;
+};
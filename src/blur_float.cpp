@@ -19,8 +19,12 @@
 //! Floating point version
 //!
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <vector>
+
+#include "simd.h"
 
 //!
 //! \fn void std_to_box(int boxes[], float sigma, int n)
@@ -59,7 +63,7 @@ void std_to_box(int boxes[], float sigma, int n) {
 //! \param[in] h            image height
 //! \param[in] r            box dimension
 //!
-void horizontal_blur(float* in, float* out, int w, int h, int r) {
+PIXEL_KERNEL void horizontal_blur(float* in, float* out, int w, int h, int r) {
   float iarr = 1.f / (r + r + 1);
 #pragma omp parallel for
   for (int i = 0; i < h; i++) {
@@ -93,31 +97,26 @@ void horizontal_blur(float* in, float* out, int w, int h, int r) {
 //! \param[in] h            image height
 //! \param[in] r            box dimension
 //!
-void total_blur(float* in, float* out, int w, int h, int r) {
+PIXEL_KERNEL void total_blur(float* in, float* out, int w, int h, int r) {
   float iarr = 1.f / (r + r + 1);
-#pragma omp parallel for
-  for (int i = 0; i < w; i++) {
-    int ti = i, li = ti, ri = ti + r * w;
-    float fv = in[ti], lv = in[ti + w * (h - 1)], val = (r + 1) * fv;
-    for (int j = 0; j < r; j++) val += in[ti + j * w];
-    for (int j = 0; j <= r; j++) {
-      val += in[ri] - fv;
-      out[ti] = val * iarr;
-      ri += w;
-      ti += w;
-    }
-    for (int j = r + 1; j < h - r; j++) {
-      val += in[ri] - in[li];
-      out[ti] = val * iarr;
-      li += w;
-      ri += w;
-      ti += w;
-    }
-    for (int j = h - r; j < h; j++) {
-      val += lv - in[li];
-      out[ti] = val * iarr;
-      li += w;
-      ti += w;
+  // Walks the rows top to bottom with one running sum per column, so the inner loops are contiguous and vectorize.
+  // Rows outside the image are clamped to the first and last row.
+  // the sums are kept per thread, so the blurs of every frame do not allocate
+  thread_local std::vector<float> val;
+  val.resize(w);
+  const float* first = in;
+  for (int i = 0; i < w; i++) val[i] = (r + 1) * first[i];
+  for (int j = 0; j < r; j++) {
+    const float* row = in + std::min(j, h - 1) * w;
+    for (int i = 0; i < w; i++) val[i] += row[i];
+  }
+  for (int j = 0; j < h; j++) {
+    const float* add = in + std::min(j + r, h - 1) * w;
+    const float* sub = in + std::max(j - r - 1, 0) * w;
+    float* dst = out + j * w;
+    for (int i = 0; i < w; i++) {
+      val[i] += add[i] - sub[i];
+      dst[i] = val[i] * iarr;
     }
   }
 }
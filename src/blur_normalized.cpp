@@ -0,0 +1,176 @@
+#include "blur_normalized.h"
+
+#include <algorithm>
+
+#include "simd.h"
+
+// Implemented in blur_float.cpp
+extern void std_to_box(int boxes[], float sigma, int n);
+extern void total_blur(float *in, float *out, int w, int h, int r);
+
+namespace {
+
+// Pixels covered by the person still get a tiny weight, so where there is no background at all within the blur
+// radius the result is the plain blur instead of a division by zero
+constexpr float min_weight = 1.f / 256.f;
+
+ALWAYS_INLINE float weight(float mask) {
+  return 1.f - mask + min_weight;
+}
+ALWAYS_INLINE float weight(uint16_t mask) {
+  return 1.f - mask * (1.f / 65535.f) + min_weight;
+}
+ALWAYS_INLINE void store(float v, float &out) {
+  out = v;
+}
+ALWAYS_INLINE void store(float v, uint8_t &out) {
+  out = uint8_t(std::clamp(v + 0.5f, 0.f, 255.f));
+}
+
+template <typename Mask, typename Plane>
+ALWAYS_INLINE void pack_full(const Mask *mask, const Plane *y, const Plane *u, const Plane *v, int n, float *out) {
+  for (int i = 0; i < n; i++) {
+    const float w = weight(mask[i]);
+    out[i * 4 + 0] = y[i] * w;
+    out[i * 4 + 1] = u[i] * w;
+    out[i * 4 + 2] = v[i] * w;
+    out[i * 4 + 3] = w;
+  }
+}
+
+// 2x2 averages of the weighted planes and the weights
+template <typename Mask, typename Plane>
+ALWAYS_INLINE void pack_half(const Mask *mask,
+                             const Plane *y,
+                             const Plane *u,
+                             const Plane *v,
+                             int w,
+                             int h,
+                             float *out) {
+  const int half_w = w / 2, half_h = h / 2;
+  for (int hy = 0; hy < half_h; hy++) {
+    for (int hx = 0; hx < half_w; hx++) {
+      float sum[4] = {0, 0, 0, 0};
+      for (int dy = 0; dy < 2; dy++) {
+        for (int dx = 0; dx < 2; dx++) {
+          const int i = (hy * 2 + dy) * w + hx * 2 + dx;
+          const float wt = weight(mask[i]);
+          sum[0] += y[i] * wt;
+          sum[1] += u[i] * wt;
+          sum[2] += v[i] * wt;
+          sum[3] += wt;
+        }
+      }
+      float *dst = out + (hy * half_w + hx) * 4;
+      for (int c = 0; c < 4; c++) dst[c] = sum[c] * 0.25f;
+    }
+  }
+}
+
+template <typename Plane>
+ALWAYS_INLINE void unpack_channel(const float *packed, int n, int channel, Plane *out) {
+  for (int i = 0; i < n; i++) store(packed[i * 4 + channel] / packed[i * 4 + 3], out[i]);
+}
+
+PIXEL_KERNEL void pack(const float *mask,
+                       const float *y,
+                       const float *u,
+                       const float *v,
+                       int w,
+                       int h,
+                       bool half,
+                       float *out) {
+  if (half) {
+    pack_half(mask, y, u, v, w, h, out);
+  } else {
+    pack_full(mask, y, u, v, w * h, out);
+  }
+}
+
+PIXEL_KERNEL void pack(const uint16_t *mask,
+                       const uint8_t *y,
+                       const uint8_t *u,
+                       const uint8_t *v,
+                       int w,
+                       int h,
+                       bool half,
+                       float *out) {
+  if (half) {
+    pack_half(mask, y, u, v, w, h, out);
+  } else {
+    pack_full(mask, y, u, v, w * h, out);
+  }
+}
+
+PIXEL_KERNEL void unpack(const float *packed, int n, int channel, float *out) {
+  unpack_channel(packed, n, channel, out);
+}
+
+PIXEL_KERNEL void unpack(const float *packed, int n, int channel, uint8_t *out) {
+  unpack_channel(packed, n, channel, out);
+}
+
+// Horizontal box blur pass over rows of interleaved 4 channel pixels, pixels outside the row are clamped to the first
+// and last pixel like in horizontal_blur. The 4 running sums fit one vector register.
+PIXEL_KERNEL void horizontal_blur_4(const float *in, float *out, int w, int h, int r) {
+  const float iarr = 1.f / (r + r + 1);
+  for (int i = 0; i < h; i++) {
+    const float *row = in + size_t(i) * w * 4;
+    float *dst = out + size_t(i) * w * 4;
+    float val[4];
+    for (int c = 0; c < 4; c++) val[c] = (r + 1) * row[c];
+    for (int j = 0; j < r; j++) {
+      const float *add = row + std::min(j, w - 1) * 4;
+      for (int c = 0; c < 4; c++) val[c] += add[c];
+    }
+    for (int j = 0; j < w; j++) {
+      const float *add = row + std::min(j + r, w - 1) * 4;
+      const float *sub = row + std::max(j - r - 1, 0) * 4;
+      for (int c = 0; c < 4; c++) {
+        val[c] += add[c] - sub[c];
+        dst[j * 4 + c] = val[c] * iarr;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+void normalized_blur::pack(const float *mask, const float *y, const float *u, const float *v, int w, int h, bool half) {
+  w_ = half ? w / 2 : w;
+  h_ = half ? h / 2 : h;
+  packed_.resize(size_t(w_) * h_ * 4);
+  ::pack(mask, y, u, v, w, h, half, packed_.data());
+}
+
+void normalized_blur::pack(const uint16_t *mask,
+                           const uint8_t *y,
+                           const uint8_t *u,
+                           const uint8_t *v,
+                           int w,
+                           int h,
+                           bool half) {
+  w_ = half ? w / 2 : w;
+  h_ = half ? h / 2 : h;
+  packed_.resize(size_t(w_) * h_ * 4);
+  ::pack(mask, y, u, v, w, h, half, packed_.data());
+}
+
+void normalized_blur::blur(float sigma) {
+  scratch_.resize(packed_.size());
+  int boxes[3];
+  std_to_box(boxes, sigma, 3);
+  for (int r : boxes) {
+    horizontal_blur_4(packed_.data(), scratch_.data(), w_, h_, r);
+    // vertically the 4 channels of a pixel are just 4 more columns
+    total_blur(scratch_.data(), packed_.data(), w_ * 4, h_, r);
+  }
+}
+
+void normalized_blur::unpack(int channel, float *out) const {
+  ::unpack(packed_.data(), w_ * h_, channel, out);
+}
+
+void normalized_blur::unpack(int channel, uint8_t *out) const {
+  ::unpack(packed_.data(), w_ * h_, channel, out);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Halo free background blur (normalized convolution). Blurring the camera frame as it is smears the person into the
+// background around them, which shows as a halo once the person is composited on top of it. Instead every pixel is
+// weighted by how much background it is (1 - mask) and the weights are blurred along: dividing the blurred weighted
+// planes by the blurred weights gives the average of the background pixels only.
+// Y, U, V and the weight are interleaved, so all four are blurred in the same box blur passes over the frame.
+class normalized_blur {
+private:
+  int w_ = 0;
+  int h_ = 0;
+  std::vector<float> packed_;  // weighted Y, U, V and the weight of every pixel
+  std::vector<float> scratch_;
+
+public:
+  // Weights and interleaves the planes (w x h), at half resolution (2x2 averages) when `half` is set
+  void pack(const float *mask, const float *y, const float *u, const float *v, int w, int h, bool half);
+  void pack(const uint16_t *mask, const uint8_t *y, const uint8_t *u, const uint8_t *v, int w, int h, bool half);
+
+  // Three box blur passes approximating a gaussian, like fast_gaussian_blur
+  void blur(float sigma);
+
+  // Writes plane `channel` (0-2 for Y, U, V) of the result, at the packed resolution
+  void unpack(int channel, float *out) const;
+  void unpack(int channel, uint8_t *out) const;
+
+  int width() const {
+    return w_;
+  }
+  int height() const {
+    return h_;
+  }
+};
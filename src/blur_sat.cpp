@@ -0,0 +1,218 @@
+#include "blur_sat.h"
+
+#include <algorithm>
+
+#include "simd.h"
+
+namespace {
+
+ALWAYS_INLINE uint32_t byte_value(float v) {
+  return uint32_t(std::clamp(v * 255.f + 0.5f, 0.f, 255.f));
+}
+ALWAYS_INLINE uint32_t byte_value(uint8_t v) {
+  return v;
+}
+ALWAYS_INLINE void store_average(uint32_t sum, float inv_area, float &out) {
+  out = sum * inv_area * (1.f / 255.f);
+}
+ALWAYS_INLINE void store_average(uint32_t sum, float inv_area, uint8_t &out) {
+  out = uint8_t(sum * inv_area + 0.5f);
+}
+
+// Every table entry is the sum of the plane values above and to the left of it, each row is the row above plus the
+// running sum of the plane row.
+template <typename T>
+ALWAYS_INLINE void integrate(const T *y,
+                             const T *u,
+                             const T *v,
+                             int w,
+                             int h,
+                             uint32_t *sum_y,
+                             uint32_t *sum_u,
+                             uint32_t *sum_v) {
+  const int stride = w + 1;
+  std::fill(sum_y, sum_y + stride, 0);
+  std::fill(sum_u, sum_u + stride, 0);
+  std::fill(sum_v, sum_v + stride, 0);
+  for (int row = 0; row < h; row++) {
+    const size_t in = size_t(row) * w, above = size_t(row) * stride, out = above + stride;
+    uint32_t run_y = 0, run_u = 0, run_v = 0;
+    sum_y[out] = sum_u[out] = sum_v[out] = 0;
+    for (int x = 0; x < w; x++) {
+      run_y += byte_value(y[in + x]);
+      run_u += byte_value(u[in + x]);
+      run_v += byte_value(v[in + x]);
+      sum_y[out + x + 1] = sum_y[above + x + 1] + run_y;
+      sum_u[out + x + 1] = sum_u[above + x + 1] + run_u;
+      sum_v[out + x + 1] = sum_v[above + x + 1] + run_v;
+    }
+  }
+}
+
+// Replaces every pixel by the average of the box around it, the radius is looked up by the distance of the pixel to
+// the person. Pixels with radius 0 keep their value.
+template <typename T>
+ALWAYS_INLINE void variable_box_blur(const uint32_t *sum_y,
+                                     const uint32_t *sum_u,
+                                     const uint32_t *sum_v,
+                                     int w,
+                                     int h,
+                                     const uint16_t *distance,
+                                     const uint8_t *radius,
+                                     int radius_size,
+                                     T *y,
+                                     T *u,
+                                     T *v) {
+  const int stride = w + 1;
+  const int max_radius = radius[radius_size - 1];
+  for (int row = 0; row < h; row++) {
+    for (int x = 0; x < w; x++) {
+      const size_t i = size_t(row) * w + x;
+      const int r = distance[i] < radius_size ? radius[distance[i]] : max_radius;
+      if (r == 0) {
+        continue;
+      }
+      const int x0 = std::max(x - r, 0), x1 = std::min(x + r + 1, w);
+      const int y0 = std::max(row - r, 0), y1 = std::min(row + r + 1, h);
+      const float inv_area = 1.f / ((x1 - x0) * (y1 - y0));
+      const size_t top_left = size_t(y0) * stride + x0, top_right = size_t(y0) * stride + x1;
+      const size_t bottom_left = size_t(y1) * stride + x0, bottom_right = size_t(y1) * stride + x1;
+      // unsigned wrap around cancels out
+      store_average(sum_y[bottom_right] - sum_y[top_right] - sum_y[bottom_left] + sum_y[top_left], inv_area, y[i]);
+      store_average(sum_u[bottom_right] - sum_u[top_right] - sum_u[bottom_left] + sum_u[top_left], inv_area, u[i]);
+      store_average(sum_v[bottom_right] - sum_v[top_right] - sum_v[bottom_left] + sum_v[top_left], inv_area, v[i]);
+    }
+  }
+}
+
+// Two pass 3-4 chamfer distance transform, the forward pass looks left and up, the backward pass right and down
+template <typename Mask>
+ALWAYS_INLINE void chamfer_distance(const Mask *mask, Mask half, int w, int h, uint16_t *distance) {
+  const int n = w * h;
+  for (int i = 0; i < n; i++) distance[i] = mask[i] >= half ? 0 : UINT16_MAX;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      const int i = y * w + x;
+      int d = distance[i];
+      if (x > 0) d = std::min(d, distance[i - 1] + 3);
+      if (y > 0) {
+        d = std::min(d, distance[i - w] + 3);
+        if (x > 0) d = std::min(d, distance[i - w - 1] + 4);
+        if (x < w - 1) d = std::min(d, distance[i - w + 1] + 4);
+      }
+      distance[i] = uint16_t(d);
+    }
+  }
+  for (int y = h - 1; y >= 0; y--) {
+    for (int x = w - 1; x >= 0; x--) {
+      const int i = y * w + x;
+      int d = distance[i];
+      if (x < w - 1) d = std::min(d, distance[i + 1] + 3);
+      if (y < h - 1) {
+        d = std::min(d, distance[i + w] + 3);
+        if (x < w - 1) d = std::min(d, distance[i + w + 1] + 4);
+        if (x > 0) d = std::min(d, distance[i + w - 1] + 4);
+      }
+      distance[i] = uint16_t(d);
+    }
+  }
+}
+
+PIXEL_KERNEL void integrate(const float *y,
+                            const float *u,
+                            const float *v,
+                            int w,
+                            int h,
+                            uint32_t *sum_y,
+                            uint32_t *sum_u,
+                            uint32_t *sum_v) {
+  integrate<float>(y, u, v, w, h, sum_y, sum_u, sum_v);
+}
+
+PIXEL_KERNEL void integrate(const uint8_t *y,
+                            const uint8_t *u,
+                            const uint8_t *v,
+                            int w,
+                            int h,
+                            uint32_t *sum_y,
+                            uint32_t *sum_u,
+                            uint32_t *sum_v) {
+  integrate<uint8_t>(y, u, v, w, h, sum_y, sum_u, sum_v);
+}
+
+PIXEL_KERNEL void variable_box_blur(const uint32_t *sum_y,
+                                    const uint32_t *sum_u,
+                                    const uint32_t *sum_v,
+                                    int w,
+                                    int h,
+                                    const uint16_t *distance,
+                                    const uint8_t *radius,
+                                    int radius_size,
+                                    float *y,
+                                    float *u,
+                                    float *v) {
+  variable_box_blur<float>(sum_y, sum_u, sum_v, w, h, distance, radius, radius_size, y, u, v);
+}
+
+PIXEL_KERNEL void variable_box_blur(const uint32_t *sum_y,
+                                    const uint32_t *sum_u,
+                                    const uint32_t *sum_v,
+                                    int w,
+                                    int h,
+                                    const uint16_t *distance,
+                                    const uint8_t *radius,
+                                    int radius_size,
+                                    uint8_t *y,
+                                    uint8_t *u,
+                                    uint8_t *v) {
+  variable_box_blur<uint8_t>(sum_y, sum_u, sum_v, w, h, distance, radius, radius_size, y, u, v);
+}
+
+}  // namespace
+
+template <typename T>
+void summed_area_tables::build_tables(const T *y, const T *u, const T *v, int w, int h) {
+  w_ = w;
+  h_ = h;
+  const size_t size = size_t(w + 1) * (h + 1);
+  y_.resize(size);
+  u_.resize(size);
+  v_.resize(size);
+  integrate(y, u, v, w, h, y_.data(), u_.data(), v_.data());
+}
+
+template <typename T>
+void summed_area_tables::blur_planes(const uint16_t *distance, int max_radius, int range, T *y, T *u, T *v) {
+  // distances are in thirds of a pixel
+  max_radius = std::clamp(max_radius, 0, 255);
+  const int size = std::max(3 * range, 1) + 1;
+  radius_.resize(size);
+  for (int d = 0; d < size; d++) radius_[d] = uint8_t(std::min(max_radius, d * max_radius / std::max(3 * range, 1)));
+  variable_box_blur(y_.data(), u_.data(), v_.data(), w_, h_, distance, radius_.data(), size, y, u, v);
+}
+
+void summed_area_tables::build(const float *y, const float *u, const float *v, int w, int h) {
+  build_tables(y, u, v, w, h);
+}
+
+void summed_area_tables::build(const uint8_t *y, const uint8_t *u, const uint8_t *v, int w, int h) {
+  build_tables(y, u, v, w, h);
+}
+
+void summed_area_tables::blur(const uint16_t *distance, int max_radius, int range, float *y, float *u, float *v) {
+  blur_planes(distance, max_radius, range, y, u, v);
+}
+
+void summed_area_tables::blur(const uint16_t *distance, int max_radius, int range, uint8_t *y, uint8_t *u, uint8_t *v) {
+  blur_planes(distance, max_radius, range, y, u, v);
+}
+
+void distance_to_person(const float *mask, int w, int h, std::vector<uint16_t> &distance) {
+  distance.resize(size_t(w) * h);
+  chamfer_distance(mask, 0.5f, w, h, distance.data());
+}
+
+void distance_to_person(const uint16_t *mask, int w, int h, std::vector<uint16_t> &distance) {
+  distance.resize(size_t(w) * h);
+  chamfer_distance(mask, uint16_t(32768), w, h, distance.data());
+}
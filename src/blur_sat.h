@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Summed-area tables (integral images) of the Y, U and V background planes. Once built, the average of any box in a
+// plane takes four lookups whatever its size, so a blur radius that changes from pixel to pixel costs no more than a
+// single box blur pass. Sums are kept as integers of the 0-255 plane values, which is exact up to 4K frames.
+class summed_area_tables {
+private:
+  int w_ = 0;
+  int h_ = 0;
+  std::vector<uint32_t> y_, u_, v_;  // (w + 1) x (h + 1), the first row and column are 0
+  std::vector<uint8_t> radius_;      // blur radius by distance to the person
+
+public:
+  // Builds the tables of all three planes in one pass over the frame
+  void build(const float *y, const float *u, const float *v, int w, int h);
+  void build(const uint8_t *y, const uint8_t *u, const uint8_t *v, int w, int h);
+
+  // Box blurs the planes the tables were built from, with a radius per pixel from its `distance` to the person (see
+  // distance_to_person): 0 at the person, growing linearly up to `max_radius` at a distance of `range` pixels.
+  // Boxes are clipped to the frame.
+  void blur(const uint16_t *distance, int max_radius, int range, float *y, float *u, float *v);
+  void blur(const uint16_t *distance, int max_radius, int range, uint8_t *y, uint8_t *u, uint8_t *v);
+
+private:
+  template <typename T>
+  void build_tables(const T *y, const T *u, const T *v, int w, int h);
+  template <typename T>
+  void blur_planes(const uint16_t *distance, int max_radius, int range, T *y, T *u, T *v);
+};
+
+// Distance of every pixel to the person in the mask (mask >= 0.5), in thirds of a pixel (3-4 chamfer distance), 0 on
+// the person itself.
+void distance_to_person(const float *mask, int w, int h, std::vector<uint16_t> &distance);
+void distance_to_person(const uint16_t *mask, int w, int h, std::vector<uint16_t> &distance);
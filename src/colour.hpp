@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Colour conversion between 8-bit RGB and YUV (Y'CbCr), shared by the frame pipeline, the background assets and the
+// tools, so that all of them agree on the colours.
+// Everything is fixed-point (16.16): RGB -> YUV multiplies with coefficients, YUV -> RGB adds up table entries for the
+// Y, U and V values, both generated at compile time for the matrix and range. The batch converters are plain loops the
+// compiler vectorizes, call them from a PIXEL_KERNEL (see simd.h) to build them for the available instruction sets.
+
+enum class colour_matrix {
+  bt601,  // SD video, webcams
+  bt709,  // HD video
+};
+
+enum class colour_range {
+  limited,  // Y 16-235, U and V 16-240 (video)
+  full,     // 0-255 (JPEG)
+};
+
+namespace colour_detail {
+
+constexpr int shift = 16;
+constexpr int32_t one = 1 << shift;
+constexpr int32_t half = 1 << (shift - 1);
+
+constexpr int32_t fixed(double v) {
+  return int32_t(v * one + (v < 0 ? -0.5 : 0.5));
+}
+
+constexpr uint8_t clamp_byte(int32_t v) {
+  return uint8_t(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+template <typename F>
+constexpr std::array<int32_t, 256> table(F f) {
+  std::array<int32_t, 256> t{};
+  for (int i = 0; i < 256; i++) t[i] = fixed(f(i));
+  return t;
+}
+
+}  // namespace colour_detail
+
+template <colour_matrix Matrix, colour_range Range>
+struct colour_space {
+  // luma weights of red and blue, green gets the rest
+  static constexpr double kr = Matrix == colour_matrix::bt601 ? 0.299 : 0.2126;
+  static constexpr double kb = Matrix == colour_matrix::bt601 ? 0.114 : 0.0722;
+  static constexpr double kg = 1 - kr - kb;
+  static constexpr double luma_scale = Range == colour_range::limited ? 219. / 255. : 1.;
+  static constexpr double chroma_scale = Range == colour_range::limited ? 224. / 255. : 1.;
+  static constexpr int32_t luma_offset = Range == colour_range::limited ? 16 : 0;
+
+  // RGB -> YUV coefficients
+  static constexpr int32_t y_r = colour_detail::fixed(luma_scale * kr);
+  static constexpr int32_t y_g = colour_detail::fixed(luma_scale * kg);
+  static constexpr int32_t y_b = colour_detail::fixed(luma_scale * kb);
+  static constexpr int32_t u_r = colour_detail::fixed(-chroma_scale * kr / (2 * (1 - kb)));
+  static constexpr int32_t u_g = colour_detail::fixed(-chroma_scale * kg / (2 * (1 - kb)));
+  static constexpr int32_t u_b = colour_detail::fixed(chroma_scale / 2);
+  static constexpr int32_t v_r = colour_detail::fixed(chroma_scale / 2);
+  static constexpr int32_t v_g = colour_detail::fixed(-chroma_scale * kg / (2 * (1 - kr)));
+  static constexpr int32_t v_b = colour_detail::fixed(-chroma_scale * kb / (2 * (1 - kr)));
+
+  // YUV -> RGB tables, the contribution of every Y, U and V value to R, G and B
+  static constexpr std::array<int32_t, 256> luma = colour_detail::table([](int y) {
+    return (y - luma_offset) / luma_scale;
+  });
+  static constexpr std::array<int32_t, 256> v_to_r = colour_detail::table([](int v) {
+    return 2 * (1 - kr) * (v - 128) / chroma_scale;
+  });
+  static constexpr std::array<int32_t, 256> u_to_g = colour_detail::table([](int u) {
+    return -2 * kb * (1 - kb) / kg * (u - 128) / chroma_scale;
+  });
+  static constexpr std::array<int32_t, 256> v_to_g = colour_detail::table([](int v) {
+    return -2 * kr * (1 - kr) / kg * (v - 128) / chroma_scale;
+  });
+  static constexpr std::array<int32_t, 256> u_to_b = colour_detail::table([](int u) {
+    return 2 * (1 - kb) * (u - 128) / chroma_scale;
+  });
+
+  static void to_yuv(int r, int g, int b, uint8_t &y, uint8_t &u, uint8_t &v) {
+    using namespace colour_detail;
+    y = clamp_byte((y_r * r + y_g * g + y_b * b + luma_offset * one + half) >> shift);
+    u = clamp_byte((u_r * r + u_g * g + u_b * b + 128 * one + half) >> shift);
+    v = clamp_byte((v_r * r + v_g * g + v_b * b + 128 * one + half) >> shift);
+  }
+
+  static void to_rgb(uint8_t y, uint8_t u, uint8_t v, uint8_t &r, uint8_t &g, uint8_t &b) {
+    using namespace colour_detail;
+    const int32_t l = luma[y] + half;
+    r = clamp_byte((l + v_to_r[v]) >> shift);
+    g = clamp_byte((l + u_to_g[u] + v_to_g[v]) >> shift);
+    b = clamp_byte((l + u_to_b[u]) >> shift);
+  }
+
+  // Batch converters of 4 byte pixels, `in` and `out` may be the same buffer
+  static void rgba_to_ayuv(const uint8_t *in, uint8_t *out, size_t pixels) {
+    for (size_t i = 0; i < pixels * 4; i += 4) {
+      const uint8_t r = in[i], g = in[i + 1], b = in[i + 2], a = in[i + 3];
+      out[i] = a;
+      to_yuv(r, g, b, out[i + 1], out[i + 2], out[i + 3]);
+    }
+  }
+
+  static void ayuv_to_rgba(const uint8_t *in, uint8_t *out, size_t pixels) {
+    for (size_t i = 0; i < pixels * 4; i += 4) {
+      const uint8_t a = in[i], y = in[i + 1], u = in[i + 2], v = in[i + 3];
+      to_rgb(y, u, v, out[i], out[i + 1], out[i + 2]);
+      out[i + 3] = a;
+    }
+  }
+
+  // RGBA to packed 3 byte YUV (4:4:4), the alpha channel is dropped
+  static void rgba_to_yuv(const uint8_t *in, uint8_t *out, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+      to_yuv(in[i * 4], in[i * 4 + 1], in[i * 4 + 2], out[i * 3], out[i * 3 + 1], out[i * 3 + 2]);
+    }
+  }
+};
+
+using bt601_limited = colour_space<colour_matrix::bt601, colour_range::limited>;
+using bt601_full = colour_space<colour_matrix::bt601, colour_range::full>;
+using bt709_limited = colour_space<colour_matrix::bt709, colour_range::limited>;
+using bt709_full = colour_space<colour_matrix::bt709, colour_range::full>;
+
+// The camera frames (YUV420P from ffmpeg) and the background assets (AYUV)
+using camera_colour = bt601_limited;
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "tile_blur.h"
+
+// Scratch space for blurring a plane, optionally at half resolution or tile by tile
+template <typename T>
+struct blur_buffers {
+  std::vector<T> scratch;
+  std::vector<T> half;
+  std::vector<T> half_scratch;
+  std::vector<T> tile;
+  std::vector<T> tile_scratch;
+};
+
+// Working planes of one frame, all at full frame resolution: the segmentation mask and the background Y, U and V
+// planes (the camera frame, blurred and/or with snowflakes drawn on it).
+// float_planes (0-1 floats) is the reference layout. compact_planes stores the mask as unorm16 and the background as
+// bytes, a third of the memory per frame, which matters once the frame no longer fits in the cache.
+template <typename Mask, typename Plane>
+struct frame_planes {
+  using mask_type = Mask;
+  using plane_type = Plane;
+
+  std::vector<Mask> mask;
+  blur_buffers<Mask> mask_blur;
+  std::vector<Plane> y, u, v;
+  blur_buffers<Plane> blur;
+
+  // blurred background planes of the previous frames, and the tiles that need to be blurred again (see tile_blur.h)
+  tile_changes changes;
+  std::vector<Plane> y_blurred, u_blurred, v_blurred;
+
+  void resize(size_t pixels) {
+    mask.resize(pixels);
+    y.resize(pixels);
+    u.resize(pixels);
+    v.resize(pixels);
+  }
+
+  // bytes held by all planes and scratch buffers
+  size_t bytes() const {
+    const auto size = [](const auto &plane) {
+      return plane.capacity() * sizeof(plane[0]);
+    };
+    const auto scratch = [&](const auto &b) {
+      return size(b.scratch) + size(b.half) + size(b.half_scratch) + size(b.tile) + size(b.tile_scratch);
+    };
+    return size(mask) + scratch(mask_blur) + size(y) + size(u) + size(v) + scratch(blur) + size(y_blurred) +
+           size(u_blurred) + size(v_blurred);
+  }
+};
+
+using float_planes = frame_planes<float, float>;
+using compact_planes = frame_planes<uint16_t, uint8_t>;
@@ -0,0 +1,34 @@
+#include "frame_pool.h"
+
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+frame_pool::~frame_pool() {
+  // buffers still held by packets are freed when they come back
+  av_buffer_pool_uninit(&pool_);
+}
+
+bool frame_pool::make_writable(AVPacket &pkt) {
+  if (pkt.buf && av_buffer_is_writable(pkt.buf)) {
+    return true;
+  }
+  const int size = pkt.size + AV_INPUT_BUFFER_PADDING_SIZE;
+  if (pool_ == nullptr || size != size_) {
+    av_buffer_pool_uninit(&pool_);
+    pool_ = av_buffer_pool_init(size, nullptr);
+    size_ = size;
+  }
+  AVBufferRef *buf = pool_ ? av_buffer_pool_get(pool_) : nullptr;
+  if (buf == nullptr) {
+    return false;
+  }
+  std::memcpy(buf->data, pkt.data, pkt.size);
+  std::memset(buf->data + pkt.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  av_buffer_unref(&pkt.buf);
+  pkt.buf = buf;
+  pkt.data = buf->data;
+  return true;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+struct AVBufferPool;
+struct AVPacket;
+
+// Pool of reference-counted frame buffers, so the frame loop can process every packet in place without allocating.
+// Packets keep their buffer whenever they are its only owner (the usual case), otherwise the pixels move into a buffer
+// from the pool that is returned to it when the packet is unreferenced.
+class frame_pool {
+private:
+  AVBufferPool *pool_ = nullptr;
+  int size_ = 0;
+
+public:
+  frame_pool() = default;
+  frame_pool(const frame_pool &) = delete;
+  frame_pool &operator=(const frame_pool &) = delete;
+  ~frame_pool();
+
+  // Makes `pkt` the sole owner of a writable buffer, returns false when out of memory.
+  bool make_writable(AVPacket &pkt);
+};
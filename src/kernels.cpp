@@ -0,0 +1,430 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "colour.hpp"
+#include "mask_spans.h"
+#include "math.hpp"
+#include "simd.h"
+#include "snowflake.h"
+
+namespace {
+
+// Conversions between the storage types of masks and planes, and the 0-1 (mask) and 0-255 (plane) values the kernels
+// compute with
+ALWAYS_INLINE float unit(float v) {
+  return v;
+}
+ALWAYS_INLINE float unit(uint16_t v) {
+  return v * (1.f / 65535.f);
+}
+ALWAYS_INLINE void store_unit(float v, float &out) {
+  out = v;
+}
+ALWAYS_INLINE void store_unit(float v, uint16_t &out) {
+  out = uint16_t(v * 65535.f + 0.5f);
+}
+ALWAYS_INLINE float byte_value(float v) {
+  return v * 255.f;
+}
+ALWAYS_INLINE float byte_value(uint8_t v) {
+  return v;
+}
+ALWAYS_INLINE void store_byte_value(double v, float &out) {
+  out = v / 255.;
+}
+ALWAYS_INLINE void store_byte_value(double v, uint8_t &out) {
+  out = uint8_t(std::clamp(v + 0.5, 0., 255.));
+}
+// stores a value in the units of the plane itself
+ALWAYS_INLINE void store(float v, float &out) {
+  out = v;
+}
+ALWAYS_INLINE void store(float v, uint8_t &out) {
+  out = uint8_t(v + 0.5f);
+}
+
+// Blends luma per pixel, and chroma once per 2x2 block. `bg` provides the background Y, U and V for a pixel index.
+// Only edge runs are blended, background runs are replaced by the background and person runs are left alone.
+template <typename Mask, typename Background>
+ALWAYS_INLINE void composite(uint8_t *frame,
+                             const Mask *mask,
+                             int w,
+                             int h,
+                             const mask_spans &spans,
+                             const Background &bg) {
+  if (spans.all_person()) {
+    return;
+  }
+
+  uint8_t *plane_y = frame;
+  for (int y = 0; y < h; y++) {
+    for (const mask_span *span = spans.row_begin(y); span != spans.row_end(y); span++) {
+      const int begin = y * w + span->begin, end = y * w + span->end;
+      if (span->kind == span_kind::background) {
+        for (int i = begin; i < end; i++) plane_y[i] = uint8_t(bg.y(i));
+      } else if (span->kind == span_kind::edge) {
+        for (int i = begin; i < end; i++) {
+          const float m = unit(mask[i]);
+          plane_y[i] = uint8_t(plane_y[i] * m + bg.y(i) * (1.f - m));
+        }
+      }
+    }
+  }
+
+  const int chroma_w = w / 2;
+  uint8_t *plane_u = frame + w * h;
+  uint8_t *plane_v = plane_u + chroma_w * (h / 2);
+  for (int cy = 0; cy < h / 2; cy++) {
+    for (const mask_span *span = spans.chroma_row_begin(cy); span != spans.chroma_row_end(cy); span++) {
+      if (span->kind == span_kind::person) {
+        continue;
+      }
+      const bool edge = span->kind == span_kind::edge;
+      for (int cx = span->begin; cx < span->end; cx++) {
+        const int i = (cy * 2) * w + cx * 2;
+        const float m =
+            edge ? (unit(mask[i]) + unit(mask[i + 1]) + unit(mask[i + w]) + unit(mask[i + w + 1])) * 0.25f : 0.f;
+        const float bg_u = (bg.u(i) + bg.u(i + 1) + bg.u(i + w) + bg.u(i + w + 1)) * 0.25f;
+        const float bg_v = (bg.v(i) + bg.v(i + 1) + bg.v(i + w) + bg.v(i + w + 1)) * 0.25f;
+        const int c = cy * chroma_w + cx;
+        plane_u[c] = uint8_t(plane_u[c] * m + bg_u * (1.f - m));
+        plane_v[c] = uint8_t(plane_v[c] * m + bg_v * (1.f - m));
+      }
+    }
+  }
+}
+
+struct solid_background {
+  float y_, u_, v_;
+  float y(int) const {
+    return y_;
+  }
+  float u(int) const {
+    return u_;
+  }
+  float v(int) const {
+    return v_;
+  }
+};
+
+template <typename Plane>
+struct planes_background {
+  const Plane *y_, *u_, *v_;
+  float scale;
+  float y(int i) const {
+    return byte_value(y_[i]) * scale;
+  }
+  float u(int i) const {
+    return byte_value(u_[i]) * scale;
+  }
+  float v(int i) const {
+    return byte_value(v_[i]) * scale;
+  }
+};
+
+struct ayuv_background {
+  const uint8_t *ayuv;
+  float y(int i) const {
+    return ayuv[i * 4 + 1];
+  }
+  float u(int i) const {
+    return ayuv[i * 4 + 2];
+  }
+  float v(int i) const {
+    return ayuv[i * 4 + 3];
+  }
+};
+
+template <typename Mask>
+ALWAYS_INLINE void upscale(const float *src, int src_w, int src_h, const region &roi, Mask *dst, int w, int h) {
+  thread_local std::vector<int> columns;  // kept per thread, so upscaling a mask every frame does not allocate
+  columns.resize(roi.w);
+  for (int x = 0; x < roi.w; x++) columns[x] = x * src_w / roi.w;
+
+  for (int y = 0; y < h; y++) {
+    Mask *row = dst + y * w;
+    if (y < roi.y || y >= roi.y + roi.h) {
+      std::fill(row, row + w, Mask(0));
+      continue;
+    }
+    const float *src_row = src + ((y - roi.y) * src_h / roi.h) * src_w;
+    std::fill(row, row + roi.x, Mask(0));
+    for (int x = 0; x < roi.w; x++) store_unit(src_row[columns[x]], row[roi.x + x]);
+    std::fill(row + roi.x + roi.w, row + w, Mask(0));
+  }
+}
+
+template <typename Plane>
+ALWAYS_INLINE void split_planes(const uint8_t *frame, int w, int h, Plane *y, Plane *u, Plane *v) {
+  const int chroma_w = w / 2;
+  const uint8_t *plane_u = frame + w * h;
+  const uint8_t *plane_v = plane_u + chroma_w * (h / 2);
+  for (int i = 0; i < w * h; i++) store_byte_value(frame[i], y[i]);
+  for (int row = 0; row < h; row++) {
+    const uint8_t *line_u = plane_u + (row / 2) * chroma_w;
+    const uint8_t *line_v = plane_v + (row / 2) * chroma_w;
+    Plane *out_u = u + row * w;
+    Plane *out_v = v + row * w;
+    for (int x = 0; x < w; x++) {
+      store_byte_value(line_u[x / 2], out_u[x]);
+      store_byte_value(line_v[x / 2], out_v[x]);
+    }
+  }
+}
+
+template <typename T>
+ALWAYS_INLINE void downsample(const T *src, int w, int h, T *dst) {
+  const int half_w = w / 2;
+  for (int y = 0; y < h / 2; y++) {
+    const T *top = src + (y * 2) * w;
+    const T *bottom = top + w;
+    T *out = dst + y * half_w;
+    for (int x = 0; x < half_w; x++) {
+      store((float(top[x * 2]) + top[x * 2 + 1] + bottom[x * 2] + bottom[x * 2 + 1]) * 0.25f, out[x]);
+    }
+  }
+}
+
+template <typename T>
+ALWAYS_INLINE void upsample(const T *src, int w, int h, T *dst) {
+  // half resolution pixel centers are at full resolution 2x + 0.5, clamp at the edges
+  const int half_w = w / 2, half_h = h / 2;
+  for (int y = 0; y < h; y++) {
+    const float fy = std::clamp((y - 0.5f) * 0.5f, 0.f, float(half_h - 1));
+    const int y0 = int(fy), y1 = std::min(y0 + 1, half_h - 1);
+    const float wy = fy - y0;
+    const T *top = src + y0 * half_w;
+    const T *bottom = src + y1 * half_w;
+    T *out = dst + y * w;
+    for (int x = 0; x < w; x++) {
+      const float fx = std::clamp((x - 0.5f) * 0.5f, 0.f, float(half_w - 1));
+      const int x0 = int(fx), x1 = std::min(x0 + 1, half_w - 1);
+      const float wx = fx - x0;
+      const float t = top[x0] + (float(top[x1]) - top[x0]) * wx;
+      const float b = bottom[x0] + (float(bottom[x1]) - bottom[x0]) * wx;
+      store(t + (b - t) * wy, out[x]);
+    }
+  }
+}
+
+template <typename Plane>
+ALWAYS_INLINE void snowflake_pixels(const snowflake &flake,
+                                    bool approx,
+                                    Plane *bg_y,
+                                    Plane *bg_u,
+                                    Plane *bg_v,
+                                    uint8_t *frame,
+                                    int w,
+                                    int h) {
+  // blends a pixel towards white, in RGB
+  const auto blend = [](float alpha, uint8_t &Y, uint8_t &U, uint8_t &V) {
+    uint8_t R, G, B;
+    camera_colour::to_rgb(Y, U, V, R, G, B);
+    camera_colour::to_yuv(int(R + (255 - R) * alpha + 0.5f),
+                          int(G + (255 - G) * alpha + 0.5f),
+                          int(B + (255 - B) * alpha + 0.5f),
+                          Y,
+                          U,
+                          V);
+  };
+  const auto to_byte = [](Plane v) {
+    return uint8_t(std::clamp(byte_value(v) + 0.5f, 0.f, 255.f));
+  };
+
+  auto flake_x = std::clamp(int(flake.x - flake.radiussize) - 1, 0, w - 1);
+  auto flake_y = std::clamp(int(flake.y - flake.radiussize) - 1, 0, h - 1);
+  auto flake_x_end = std::clamp(int(flake_x + (flake.radiussize * 2.5) + 2), 0, w - 1);
+  auto flake_y_end = std::clamp(int(flake_y + (flake.radiussize * 2.5) + 2), 0, h - 1);
+
+  for (int y = flake_y; y < flake_y_end; y++) {
+    for (int x = flake_x; x < flake_x_end; x++) {
+      // only the pixels within the snowflake change
+      auto dist = approx ? get_distance_approx(double(x), double(y), flake.x, flake.y)
+                         : get_distance(double(x), double(y), flake.x, flake.y);
+      if (dist >= flake.radiussize) {
+        continue;
+      }
+      const float color_alpha = (1. - flake.expf(dist / flake.radiussize, 1000)) * flake.opacity;
+
+      // draw on the background planes
+      Plane *pY = bg_y + (y * w) + x, *pU = bg_u + (y * w) + x, *pV = bg_v + (y * w) + x;
+      uint8_t Y = to_byte(*pY), U = to_byte(*pU), V = to_byte(*pV);
+      blend(color_alpha, Y, U, V);
+      store_byte_value(Y, *pY), store_byte_value(U, *pU), store_byte_value(V, *pV);
+
+      // draw only large snowflakes (> 5.5) on top of the person!
+      if (flake.radiussize > 5.5) {
+        const int index_Y = y * w + x;
+        const int index_U = (w * h) + (y / 2) * (w / 2) + x / 2;
+        const int index_V = index_U + (w / 2) * (h / 2);
+        blend(color_alpha, frame[index_Y], frame[index_U], frame[index_V]);
+      }
+    }
+  }
+}
+
+// Area average of a plane scaled to dw x dh: every output pixel averages the source pixels it covers (one when
+// scaling up). Source rows are summed first, a loop over the full width the compiler vectorizes.
+ALWAYS_INLINE void scale_plane(const uint8_t *src, int sw, int sh, uint8_t *dst, int dw, int dh) {
+  thread_local std::vector<uint32_t> sums;
+  sums.resize(sw);
+  for (int y = 0; y < dh; y++) {
+    const int y0 = int(int64_t(y) * sh / dh);
+    const int y1 = std::max(y0 + 1, int(int64_t(y + 1) * sh / dh));
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int sy = y0; sy < y1; sy++) {
+      const uint8_t *row = src + size_t(sy) * sw;
+      for (int x = 0; x < sw; x++) sums[x] += row[x];
+    }
+    uint8_t *out = dst + size_t(y) * dw;
+    for (int x = 0; x < dw; x++) {
+      const int x0 = int(int64_t(x) * sw / dw);
+      const int x1 = std::max(x0 + 1, int(int64_t(x + 1) * sw / dw));
+      uint32_t sum = 0;
+      for (int sx = x0; sx < x1; sx++) sum += sums[sx];
+      const uint32_t n = uint32_t(x1 - x0) * uint32_t(y1 - y0);
+      out[x] = uint8_t((sum + n / 2) / n);
+    }
+  }
+}
+
+}  // namespace
+
+PIXEL_KERNEL void softmax_person(const float *logits, float *out, int n) {
+  // exp(person) / (exp(background) + exp(person)), rewritten to a single exp
+  for (int i = 0; i < n; i++) {
+    out[i] = 1.f / (1.f + std::exp(logits[i * 2] - logits[i * 2 + 1]));
+  }
+}
+
+PIXEL_KERNEL void upscale_mask(const float *src, int src_w, int src_h, const region &roi, float *dst, int w, int h) {
+  upscale(src, src_w, src_h, roi, dst, w, h);
+}
+
+PIXEL_KERNEL void upscale_mask(const float *src, int src_w, int src_h, const region &roi, uint16_t *dst, int w, int h) {
+  upscale(src, src_w, src_h, roi, dst, w, h);
+}
+
+PIXEL_KERNEL void yuv420p_to_planes(const uint8_t *frame, int w, int h, float *y, float *u, float *v) {
+  split_planes(frame, w, h, y, u, v);
+}
+
+PIXEL_KERNEL void yuv420p_to_planes(const uint8_t *frame, int w, int h, uint8_t *y, uint8_t *u, uint8_t *v) {
+  split_planes(frame, w, h, y, u, v);
+}
+
+PIXEL_KERNEL void composite_solid(uint8_t *frame,
+                                  const float *mask,
+                                  int w,
+                                  int h,
+                                  const mask_spans &spans,
+                                  uint8_t bg_y,
+                                  uint8_t bg_u,
+                                  uint8_t bg_v) {
+  composite(frame, mask, w, h, spans, solid_background{float(bg_y), float(bg_u), float(bg_v)});
+}
+
+PIXEL_KERNEL void composite_solid(uint8_t *frame,
+                                  const uint16_t *mask,
+                                  int w,
+                                  int h,
+                                  const mask_spans &spans,
+                                  uint8_t bg_y,
+                                  uint8_t bg_u,
+                                  uint8_t bg_v) {
+  composite(frame, mask, w, h, spans, solid_background{float(bg_y), float(bg_u), float(bg_v)});
+}
+
+PIXEL_KERNEL void composite_planes(uint8_t *frame,
+                                   const float *mask,
+                                   int w,
+                                   int h,
+                                   const mask_spans &spans,
+                                   const float *bg_y,
+                                   const float *bg_u,
+                                   const float *bg_v,
+                                   float scale) {
+  composite(frame, mask, w, h, spans, planes_background<float>{bg_y, bg_u, bg_v, scale});
+}
+
+PIXEL_KERNEL void composite_planes(uint8_t *frame,
+                                   const uint16_t *mask,
+                                   int w,
+                                   int h,
+                                   const mask_spans &spans,
+                                   const uint8_t *bg_y,
+                                   const uint8_t *bg_u,
+                                   const uint8_t *bg_v,
+                                   float scale) {
+  composite(frame, mask, w, h, spans, planes_background<uint8_t>{bg_y, bg_u, bg_v, scale});
+}
+
+PIXEL_KERNEL void composite_ayuv(uint8_t *frame,
+                                 const float *mask,
+                                 int w,
+                                 int h,
+                                 const mask_spans &spans,
+                                 const uint8_t *ayuv) {
+  composite(frame, mask, w, h, spans, ayuv_background{ayuv});
+}
+
+PIXEL_KERNEL void composite_ayuv(uint8_t *frame,
+                                 const uint16_t *mask,
+                                 int w,
+                                 int h,
+                                 const mask_spans &spans,
+                                 const uint8_t *ayuv) {
+  composite(frame, mask, w, h, spans, ayuv_background{ayuv});
+}
+
+PIXEL_KERNEL void downsample_2x(const float *src, int w, int h, float *dst) {
+  downsample(src, w, h, dst);
+}
+
+PIXEL_KERNEL void downsample_2x(const uint8_t *src, int w, int h, uint8_t *dst) {
+  downsample(src, w, h, dst);
+}
+
+PIXEL_KERNEL void upsample_2x(const float *src, int w, int h, float *dst) {
+  upsample(src, w, h, dst);
+}
+
+PIXEL_KERNEL void upsample_2x(const uint8_t *src, int w, int h, uint8_t *dst) {
+  upsample(src, w, h, dst);
+}
+
+PIXEL_KERNEL void scale_yuv420p(const uint8_t *frame, int w, int h, uint8_t *out, int out_w, int out_h) {
+  const size_t luma = size_t(w) * h, out_luma = size_t(out_w) * out_h;
+  scale_plane(frame, w, h, out, out_w, out_h);
+  scale_plane(frame + luma, w / 2, h / 2, out + out_luma, out_w / 2, out_h / 2);
+  scale_plane(frame + luma * 5 / 4, w / 2, h / 2, out + out_luma * 5 / 4, out_w / 2, out_h / 2);
+}
+
+PIXEL_KERNEL void rgba_to_ayuv(const uint8_t *in, uint8_t *out, size_t pixels) {
+  camera_colour::rgba_to_ayuv(in, out, pixels);
+}
+
+PIXEL_KERNEL void draw_snowflake(const snowflake &flake,
+                                 bool approx,
+                                 float *bg_y,
+                                 float *bg_u,
+                                 float *bg_v,
+                                 uint8_t *frame,
+                                 int w,
+                                 int h) {
+  snowflake_pixels(flake, approx, bg_y, bg_u, bg_v, frame, w, h);
+}
+
+PIXEL_KERNEL void draw_snowflake(const snowflake &flake,
+                                 bool approx,
+                                 uint8_t *bg_y,
+                                 uint8_t *bg_u,
+                                 uint8_t *bg_v,
+                                 uint8_t *frame,
+                                 int w,
+                                 int h) {
+  snowflake_pixels(flake, approx, bg_y, bg_u, bg_v, frame, w, h);
+}
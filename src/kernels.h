@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "region.h"
+
+class mask_spans;
+class snowflake;
+
+// Pixel kernels of the frame pipeline, every kernel is built for multiple instruction sets (see simd.h).
+// Frames are YUV420P, masks and planes are full frame resolution. Float masks and planes hold values in the range 0-1,
+// compact masks are unorm16 (0-65535) and compact planes are bytes (0-255), they are converted in the kernels only.
+
+// Person probability from the (background, person) logits of the google meet models (softmax)
+void softmax_person(const float *logits, float *out, int n);
+
+// Nearest neighbour upscale of a model sized mask to the region `roi` of the frame, everything outside it is 0
+void upscale_mask(const float *src, int src_w, int src_h, const region &roi, float *dst, int w, int h);
+void upscale_mask(const float *src, int src_w, int src_h, const region &roi, uint16_t *dst, int w, int h);
+
+// Splits a frame into full resolution Y, U and V planes
+void yuv420p_to_planes(const uint8_t *frame, int w, int h, float *y, float *u, float *v);
+void yuv420p_to_planes(const uint8_t *frame, int w, int h, uint8_t *y, uint8_t *u, uint8_t *v);
+
+// Blends the person (mask = 1) in the frame over a background, chroma uses the average mask of each 2x2 block.
+// Only the edge runs of `spans` (built from the same mask) are blended. Background planes are multiplied by `scale`
+// after conversion to 0-255.
+void composite_solid(uint8_t *frame,
+                     const float *mask,
+                     int w,
+                     int h,
+                     const mask_spans &spans,
+                     uint8_t bg_y,
+                     uint8_t bg_u,
+                     uint8_t bg_v);
+void composite_solid(uint8_t *frame,
+                     const uint16_t *mask,
+                     int w,
+                     int h,
+                     const mask_spans &spans,
+                     uint8_t bg_y,
+                     uint8_t bg_u,
+                     uint8_t bg_v);
+void composite_planes(uint8_t *frame,
+                      const float *mask,
+                      int w,
+                      int h,
+                      const mask_spans &spans,
+                      const float *bg_y,
+                      const float *bg_u,
+                      const float *bg_v,
+                      float scale);
+void composite_planes(uint8_t *frame,
+                      const uint16_t *mask,
+                      int w,
+                      int h,
+                      const mask_spans &spans,
+                      const uint8_t *bg_y,
+                      const uint8_t *bg_u,
+                      const uint8_t *bg_v,
+                      float scale);
+void composite_ayuv(uint8_t *frame, const float *mask, int w, int h, const mask_spans &spans, const uint8_t *ayuv);
+void composite_ayuv(uint8_t *frame, const uint16_t *mask, int w, int h, const mask_spans &spans, const uint8_t *ayuv);
+
+// Half resolution copy of a plane (2x2 box average), and the bilinear way back to full resolution (w x h)
+void downsample_2x(const float *src, int w, int h, float *dst);
+void downsample_2x(const uint8_t *src, int w, int h, uint8_t *dst);
+void upsample_2x(const float *src, int w, int h, float *dst);
+void upsample_2x(const uint8_t *src, int w, int h, uint8_t *dst);
+
+// Scales a w x h frame to out_w x out_h (even sizes), averaging the pixels each output pixel covers
+void scale_yuv420p(const uint8_t *frame, int w, int h, uint8_t *out, int out_w, int out_h);
+
+// Converts RGBA pixels to AYUV (camera_colour, see colour.hpp)
+void rgba_to_ayuv(const uint8_t *in, uint8_t *out, size_t pixels);
+
+// Draws a snowflake on the background planes, and (large flakes only) on top of the person in the frame
+void draw_snowflake(const snowflake &flake,
+                    bool approx,
+                    float *bg_y,
+                    float *bg_u,
+                    float *bg_v,
+                    uint8_t *frame,
+                    int w,
+                    int h);
+void draw_snowflake(const snowflake &flake,
+                    bool approx,
+                    uint8_t *bg_y,
+                    uint8_t *bg_u,
+                    uint8_t *bg_v,
+                    uint8_t *frame,
+                    int w,
+                    int h);
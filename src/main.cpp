@@ -1,32 +1,71 @@
+#include <array>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include "Console.hpp"
 #include "ffmpeg_headers.hpp"
-#include "math.hpp"
+#include "kernels.h"
+#include "perf_stats.h"
 #include "program.h"
+#include "simd.h"
 #include "snowflake.h"
 
 #include <signal.h>
 #include <stdio.h>
 
-extern double tt;  // snowflake.cpp
-
 namespace cr = CppReadline;
 using ret = cr::Console::ReturnCode;
 
 program::program(int argc, char **argv)
-    : models({
+    : model_pool_(std::make_shared<model_pool>(std::thread::hardware_concurrency())),
+      pool_(std::make_shared<thread_pool>(4)),
+      asset_cache_(std::make_shared<asset_cache>(asset_cache::default_dir())),
+      models({
           {google_meet_full, {"models/segm_full_v679.tflite", 256, 144}},
           {google_meet_lite, {"models/segm_lite_v681.tflite", 160, 96}},
           {mlkit, {"models/selfiesegmentation_mlkit-256x256-2021_01_19-v1215.f16.tflite", 256, 256}},
-      }) {}
+      }),
+      anim_bg(std::make_shared<animation_frames>()) {
+  // flat dark grey AYUV, shown until the backgrounds are loaded
+  placeholder_bg.resize(src_w * src_h * 4);
+  for (size_t i = 0; i < placeholder_bg.size(); i += 4) {
+    placeholder_bg[i] = 0xFF;
+    placeholder_bg[i + 1] = 0x40;
+    placeholder_bg[i + 2] = 0x80;
+    placeholder_bg[i + 3] = 0x80;
+  }
+}
+
+program::program(const program &parent,
+                 const std::string &camera,
+                 const std::string &input,
+                 const std::string &output)
+    : model_pool_(parent.model_pool_),
+      pool_(parent.pool_),
+      asset_cache_(parent.asset_cache_),
+      sigma_bg_blur(parent.sigma_bg_blur),
+      sigma_segmask(parent.sigma_segmask),
+      bg_file(parent.bg_file),
+      models(parent.models),
+      config_(std::make_shared<snapshot<stream_config>>(parent.config_->latest())),
+      model_selected(config_->latest().model),
+      camera_device(camera),
+      in_filename(input),
+      out_filename(output),
+      anim_bg(parent.anim_bg),
+      placeholder_bg(parent.placeholder_bg) {
+  // the additional outputs belong to the parent stream
+  config_->update([](stream_config &config) {
+    config.sinks.clear();
+  });
+}
 
 program::~program() {
-  stop({});
+  stop_all();
 }
 
 unsigned program::list_cams(const std::vector<std::string> &input) {
@@ -72,6 +111,7 @@ unsigned program::set_mode(const std::vector<std::string> &input) {
     std::cout << "- animated\n";
     std::cout << "- snowflakes" << std::endl;
     std::cout << "- snowflakesblur" << std::endl;
+    std::cout << "- depthoffield" << std::endl;
     std::cout << "- external <image_path>" << std::endl;
   };
   if (input.size() > 1 && input[1] != "external" || input.size() < 2) {
@@ -81,7 +121,7 @@ unsigned program::set_mode(const std::vector<std::string> &input) {
     }
   }
 
-  animate = false;
+  segmentation_mode mode;
   if (input[1] == "normal") {
     mode = segmentation_mode::bypass;
   } else if (input[1] == "white") {
@@ -93,22 +133,45 @@ unsigned program::set_mode(const std::vector<std::string> &input) {
   } else if (input[1] == "virtual") {
     mode = segmentation_mode::virtual_background;
   } else if (input[1] == "animated") {
-    load_spaceship_frames_into_memory(true);
-    mode = segmentation_mode::virtual_background;
-    animate = true;
+    // the current background stays until all frames of the animation are loaded
+    auto apply = switch_request();
+    load_spaceship_frames_into_memory(true, [apply]() {
+      apply([](stream_config &config) {
+        config.mode = segmentation_mode::virtual_background;
+        config.animate = true;
+      });
+    });
+    return 0;
   } else if (input[1] == "snowflakes") {
     mode = segmentation_mode::snowflakes;
   } else if (input[1] == "snowflakesblur") {
     mode = segmentation_mode::snowflakes_blur;
+  } else if (input[1] == "depthoffield") {
+    mode = segmentation_mode::depth_of_field;
   } else if (input[1] == "external") {
     return set_background(input);
   } else {
     usage();
     return 1;
   }
+  switch_request()([&](stream_config &config) {
+    config.mode = mode;
+    config.animate = false;
+  });
   return 0;
 }
 
+std::function<void(const std::function<void(stream_config &)> &)> program::switch_request() {
+  const unsigned request = ++*switch_requests_;
+  return [config = config_, requests = switch_requests_, request](const std::function<void(stream_config &)> &change) {
+    config->update([&](stream_config &next) {
+      if (*requests == request) {
+        change(next);
+      }
+    });
+  };
+}
+
 unsigned program::preview(const std::vector<std::string> &input) {
   const auto usage = [=]() {
     std::cout << "Usage: " << input[0] << "\n";
@@ -117,8 +180,8 @@ unsigned program::preview(const std::vector<std::string> &input) {
     usage();
     return 1;
   }
-  std::thread background([]() {
-    Process process("ffplay /dev/video9 2>&1", "", [](const char *bytes, size_t n) {});
+  std::thread background([=]() {
+    Process process("ffplay " + out_filename + " 2>&1", "", [](const char *bytes, size_t n) {});
     auto exit_status = process.get_exit_status();
     std::cout << "Preview window exited: " << exit_status << std::endl;
   });
@@ -127,67 +190,228 @@ unsigned program::preview(const std::vector<std::string> &input) {
 }
 
 unsigned program::set_model(const std::vector<std::string> &input) {
-  model_selected = segmentation_model::google_meet_full;
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < model >\n";
+    std::cout << "Valid models:\n";
+    std::cout << "- full   (google meet, 256x144)\n";
+    std::cout << "- lite   (google meet, 160x96)\n";
+    std::cout << "- mlkit  (mlkit selfie segmentation, 256x256)" << std::endl;
+  };
+  const std::map<std::string, segmentation_model> names = {
+      {"full", google_meet_full},
+      {"lite", google_meet_lite},
+      {"mlkit", mlkit},
+  };
+  if (input.size() != 2 || names.find(input[1]) == names.end()) {
+    usage();
+    return 1;
+  }
+  const segmentation_model selected = names.at(input[1]);
+
+  // not running, start() will pick it up
+  if (!running_) {
+    model_selected = selected;
+    config_->update([&](stream_config &config) {
+      config.model = selected;
+    });
+    std::cout << "Selected model: " << models.at(selected).filename << std::endl;
+    return 0;
+  }
+
+  // load the model and build an interpreter in the background, the frame loop keeps using the current one meanwhile
+  if (model_loader_.joinable()) model_loader_.join();
+  model_loader_ = std::thread([this, selected]() {
+    queue_model(selected);
+  });
+  return 0;
+}
+
+void program::queue_model(segmentation_model selected) {
+  const auto &filename = models.at(selected).filename;
+  if (!model_pool_->preload(filename)) {
+    std::cout << "Failed to load model: " << filename << std::endl;
+    return;
+  }
+  std::unique_lock<std::mutex> lock(model_mut_);
+  pending_model_ = selected;
+  model_pending_ = true;
+  std::cout << "Switching to model: " << filename << std::endl;
+}
+
+void program::apply_pending_model() {
+  if (!model_pending_.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(model_mut_);
+  model_selected = pending_model_;
+  model = models[model_selected];
+  model_pending_ = false;
+  config_->update([&](stream_config &config) {
+    config.model = model_selected;
+  });
+
+  // the previous inference result has the layout of the old model, force a new inference for this frame
+  model_output.clear();
+  roi_tracker_.reset(src_w, src_h);
+  scene_change_.reset(src_w, src_h);
+}
+
+unsigned program::set_roi(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < on | off >\n";
+    std::cout << "  on:  only run the model on the region around the person (tracked from the previous mask)\n";
+    std::cout << "  off: always run the model on the full frame\n";
+  };
+  if (input.size() != 2 || (input[1] != "on" && input[1] != "off")) {
+    usage();
+    return 1;
+  }
+  config_->update([&](stream_config &config) {
+    config.use_roi = input[1] == "on";
+  });
+  std::cout << "Region of interest tracking: " << input[1] << std::endl;
+  return 0;
+}
+
+unsigned program::set_gating(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < on | off > [ threshold ] [ max_stale_frames ]\n";
+    std::cout << "  Skip inference and reuse the previous mask while the frame barely changes.\n";
+    std::cout << "  threshold:        mean luma difference that counts as a change (default: 1.5)\n";
+    std::cout << "  max_stale_frames: maximum number of frames in a row that reuse the mask (default: 5)\n";
+  };
+  if (input.size() < 2 || input.size() > 4 || (input[1] != "on" && input[1] != "off")) {
+    usage();
+    return 1;
+  }
+  const stream_config current = config_->latest();
+  float threshold = current.gating_threshold;
+  int max_stale = current.gating_max_stale;
+  try {
+    if (input.size() > 2) threshold = std::stof(input[2]);
+    if (input.size() > 3) max_stale = std::stoi(input[3]);
+  } catch (const std::exception &) {
+    usage();
+    return 1;
+  }
+  config_->update([&](stream_config &config) {
+    config.use_gating = input[1] == "on";
+    config.gating_threshold = threshold;
+    config.gating_max_stale = max_stale;
+  });
+  std::cout << "Scene change gating: " << input[1] << " (threshold " << threshold << ", max stale " << max_stale << ")"
+            << std::endl;
   return 0;
 }
 
 unsigned program::start(const std::vector<std::string> &input) {
-  process_runner_ = std::thread([&]() {
-    started = true;
-    // we will now assume these loopback devices are already present
-    // handled via wrapper-script, since `sudo` might prompt for user interaction
-    // this shell is not compatible with that right now..
-    //  std::stringstream ss;
-    //  ss << "sudo modprobe -r v4l2loopback; ";
-    //  ss << "sudo modprobe v4l2loopback video_nr=8,9 exclusive_caps=0,1 card_label=\"Virtual Temp Camera "
-    //        "Input\",\"Virtual 640x480 420P TFlite Camera\"; "e
-
-    // // handle first part synchronously
-    // Process process(ss.str(), "", [](const char *bytes, size_t n) {});
-    // auto exit_status = process.get_exit_status();:
-
-    // ss.str("");e
-    // ss.clear();
-
-    //  worked for ideapad: ss << "/usr/bin/ffmpeg -i " << camera_device
-    //  check: sudo v4l2-ctl -d /dev/video0 --all
-    //  check: sudo v4l2-ctl -d /dev/video0 --list-formats-ex
-    std::stringstream ss;
-    ss << "/usr/bin/ffmpeg -fflags nobuffer -pix_fmt mjpeg -i " << camera_device
-       << " -f v4l2 -input_format mjpeg -framerate 10 -video_size 1024x680 -vf "
-          "scale=640:480:force_original_aspect_ratio=increase,crop=640:480 -pix_fmt yuv420p -f v4l2 /dev/video8 2>&1";
-
-    process_.reset(new Process(
-        ss.str(),
-        "",
-        [](const char *bytes, size_t n) {
-          // std::cout << "Output from stdout: " << std::string(bytes, n);
-        },
-        nullptr,
-        true));
+  // resume instantly when paused, everything is still loaded and the devices are still open
+  if (paused_) {
+    {
+      std::unique_lock<std::mutex> lock(pause_mut_);
+      paused_ = false;
+    }
+    pause_cv_.notify_all();
+    std::cout << "resumed." << std::endl;
+    return 0;
+  }
+  if (running_) {
+    std::cout << "already running." << std::endl;
+    return 1;
+  }
+  // the previous run ended by itself (e.g. the camera went away), clean it up first
+  if (runner_.joinable()) stop({});
+
+  // we will now assume these loopback devices are already present
+  // handled via wrapper-script, since `sudo` might prompt for user interaction
+  // this shell is not compatible with that right now..
+  //  std::stringstream ss;
+  //  ss << "sudo modprobe -r v4l2loopback; ";
+  //  ss << "sudo modprobe v4l2loopback video_nr=8,9 exclusive_caps=0,1 card_label=\"Virtual Temp Camera "
+  //        "Input\",\"Virtual 640x480 420P TFlite Camera\"; "e
+
+  // // handle first part synchronously
+  // Process process(ss.str(), "", [](const char *bytes, size_t n) {});
+  // auto exit_status = process.get_exit_status();:
+
+  // ss.str("");e
+  // ss.clear();
+
+  //  worked for ideapad: ss << "/usr/bin/ffmpeg -i " << camera_device
+  //  check: sudo v4l2-ctl -d /dev/video0 --all
+  //  check: sudo v4l2-ctl -d /dev/video0 --list-formats-ex
+  std::stringstream ss;
+  ss << "/usr/bin/ffmpeg -fflags nobuffer -pix_fmt mjpeg -i " << camera_device
+     << " -f v4l2 -input_format mjpeg -framerate 10 -video_size 1024x680 -vf "
+        "scale=640:480:force_original_aspect_ratio=increase,crop=640:480 -pix_fmt yuv420p -f v4l2 "
+     << in_filename << " 2>&1";
+
+  {
+    std::unique_lock<std::mutex> lock(feed_mut_);
+    feed_ready_ = false;
+    feed_exited_ = false;
+  }
+  process_.reset(new Process(
+      ss.str(),
+      "",
+      [this](const char *bytes, size_t n) {
+        // std::cout << "Output from stdout: " << std::string(bytes, n);
+        // ffmpeg has set up the input device once it starts transcoding
+        const std::string output(bytes, n);
+        if (output.find("Press [q]") != std::string::npos || output.find("frame=") != std::string::npos) {
+          std::unique_lock<std::mutex> lock(feed_mut_);
+          feed_ready_ = true;
+          feed_cv_.notify_all();
+        }
+      },
+      nullptr,
+      true));
+  started = true;
 
+  process_runner_ = std::thread([this]() {
     auto exit_status = process_->get_exit_status();
     std::cout << "Exit: " << exit_status << std::endl;
+    std::unique_lock<std::mutex> lock(feed_mut_);
+    feed_exited_ = true;
+    feed_cv_.notify_all();
   });
 
-  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-
   if (const char *env_p = std::getenv("BG")) {
     bg_file = std::string(env_p);
   }
   model = models[model_selected];
 
-  // Load a background to test
+  // Load the model and the backgrounds on the pool, while ffmpeg and the devices are starting up.
+  // Frames are passed through until the model is ready, and a placeholder background is used until the
+  // backgrounds are loaded.
+  model_loaded_ = false;
+  model_loading_ = std::shared_future<void>(pool_->submit([this]() {
+    load_tensorflow_model();
+  }));
+
+  // Load a background to test (unless it is still loaded from a previous start)
   // TODO: Implement loading the file path from a configuration file to increase the flexibility of the program
-  if (mode != segmentation_mode::external_background) {
-    load(bg, bg_file);
+  const stream_config config = config_->latest();
+  if (config.mode != segmentation_mode::external_background && (!config.bg || config.bg_file != bg_file)) {
+    const std::string file = bg_file;
+    bg_loading_file_ = file;
+    bg_loading_ = pool_->submit([file, w = src_w, h = src_h, sigma = sigma_bg_blur, cache = asset_cache_]() {
+      try {
+        return load_background(file, w, h, sigma, *cache);
+      } catch (const std::exception &e) {
+        std::cout << "Warning: " << e.what() << std::endl;
+      }
+      return background_assets{};
+    });
   }
 
   load_spaceship_frames_into_memory();
 
+  stop_ = false;
+  running_ = true;
   runner_ = std::thread([&]() {
-    stop_ = false;
     run();
+    running_ = false;
   });
 
   return 0;
@@ -202,15 +426,195 @@ unsigned program::stop(const std::vector<std::string> &input) {
   }
   if (!stop_) {
     std::cout << "stopping 2..." << std::endl;
-    stop_ = true;
+    {
+      std::unique_lock<std::mutex> lock(pause_mut_);
+      stop_ = true;
+      paused_ = false;
+    }
+    pause_cv_.notify_all();
     if (runner_.joinable()) runner_.join();
   }
+  if (model_loading_.valid()) model_loading_.wait();
+  if (bg_loading_.valid()) bg_loading_.wait();
+  if (governor_model_.valid()) governor_model_.wait();
+  return 0;
+}
+
+unsigned program::pause(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << "\n";
+    std::cout << "  Parks the pipeline, keeping the devices open and everything loaded. Use start to resume.\n";
+  };
+  if (input.size() != 1) {
+    usage();
+    return 1;
+  }
+  if (!running_) {
+    std::cout << "not running." << std::endl;
+    return 1;
+  }
+  paused_ = true;
+  std::cout << "paused." << std::endl;
+  return 0;
+}
+
+bool program::wait_for_feed() {
+  std::unique_lock<std::mutex> lock(feed_mut_);
+  feed_cv_.wait_for(lock, std::chrono::seconds(10), [&]() {
+    return feed_ready_ || feed_exited_;
+  });
+  // if ffmpeg is still running without reporting progress, try to open the device anyway
+  return !feed_exited_;
+}
+
+bool program::model_ready() {
+  if (!model_loaded_ && is_ready(model_loading_)) {
+    model_loading_.get();
+    roi_tracker_.reset(src_w, src_h);
+    scene_change_.reset(src_w, src_h);
+    model_loaded_ = true;
+  }
+  return model_loaded_;
+}
+
+void program::use_loaded_assets() {
+  if (is_ready(bg_loading_)) {
+    const background_assets loaded = bg_loading_.get();
+    if (!loaded.image) {
+      return;
+    }
+    config_->update([&](stream_config &config) {
+      // an external background selected while this one was loading stays
+      if (config.mode != segmentation_mode::external_background) {
+        config.bg = loaded.image;
+        config.bg_blurred = loaded.blurred;
+        config.bg_file = bg_loading_file_;
+      }
+    });
+  }
+}
+
+void program::stop_all() {
+  streams_.clear();
+  stop({});
+  if (model_loader_.joinable()) model_loader_.join();
+}
+
+unsigned program::add_stream(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < camera > < input > < output >\n";
+    std::cout << "  e.g. " << input[0] << " /dev/video2 /dev/video10 /dev/video11\n";
+    std::cout << "  Serves an additional camera from this process, with the current mode and model.\n";
+    std::cout << "  The input and output loopback devices need to exist already.\n";
+  };
+  if (input.size() != 4) {
+    usage();
+    return 1;
+  }
+  streams_.push_back(std::make_unique<program>(*this, input[1], input[2], input[3]));
+  streams_.back()->start({"start"});
+  std::cout << "Started stream " << streams_.size() << ": " << input[1] << " -> " << input[2] << " -> " << input[3]
+            << std::endl;
+  return 0;
+}
+
+unsigned program::list_streams(const std::vector<std::string> &input) {
+  std::cout << "0: " << camera_device << " -> " << in_filename << " -> " << out_filename
+            << (started ? "" : " (stopped)") << std::endl;
+  for (size_t i = 0; i < streams_.size(); i++) {
+    const auto &s = *streams_[i];
+    std::cout << (i + 1) << ": " << s.camera_device << " -> " << s.in_filename << " -> " << s.out_filename << std::endl;
+  }
+  return 0;
+}
+
+unsigned program::remove_stream(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < index >\n";
+    std::cout << "  see list-streams for the index (the primary stream 0 is controlled with start/stop)\n";
+  };
+  size_t index = 0;
+  try {
+    if (input.size() == 2) index = std::stoul(input[1]);
+  } catch (const std::exception &) {
+  }
+  if (index < 1 || index > streams_.size()) {
+    usage();
+    return 1;
+  }
+  streams_.erase(streams_.begin() + (index - 1));
+  return 0;
+}
+
+unsigned program::add_sink(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < output > < WxH >\n";
+    std::cout << "  e.g. " << input[0] << " /dev/video12 320x240\n";
+    std::cout << "  Also writes the frames of this stream to another loopback device, scaled to its own resolution\n";
+    std::cout << "  (even width and height). The model runs once for all outputs. Sinks are not paced (set-pacing),\n";
+    std::cout << "  they get each frame as soon as it is processed.\n";
+  };
+  sink_spec spec;
+  char end = 0;
+  if (input.size() != 3 || sscanf(input[2].c_str(), "%dx%d%c", &spec.w, &spec.h, &end) != 2 || spec.w <= 0 ||
+      spec.h <= 0 || spec.w % 2 || spec.h % 2 || spec.w > 4096 || spec.h > 4096) {
+    usage();
+    return 1;
+  }
+  spec.device = input[1];
+  if (spec.device == out_filename) {
+    std::cout << spec.device << " is the output of this stream already" << std::endl;
+    return 1;
+  }
+  // a device already in the list gets the new resolution
+  config_->update([&](stream_config &config) {
+    config.sinks.erase(std::remove_if(config.sinks.begin(),
+                                      config.sinks.end(),
+                                      [&](const sink_spec &sink) {
+                                        return sink.device == spec.device;
+                                      }),
+                       config.sinks.end());
+    config.sinks.push_back(spec);
+  });
+  std::cout << "Output: " << spec.device << " (" << spec.w << "x" << spec.h << ")" << std::endl;
+  return 0;
+}
+
+unsigned program::list_sinks(const std::vector<std::string> &input) {
+  const stream_config config = config_->latest();
+  std::cout << "0: " << out_filename << " (" << src_w << "x" << src_h << ")" << std::endl;
+  for (size_t i = 0; i < config.sinks.size(); i++) {
+    const sink_spec &sink = config.sinks[i];
+    std::cout << (i + 1) << ": " << sink.device << " (" << sink.w << "x" << sink.h << ")" << std::endl;
+  }
+  return 0;
+}
+
+unsigned program::remove_sink(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < index >\n";
+    std::cout << "  see list-sinks for the index (the output 0 of the stream stays)\n";
+  };
+  size_t index = 0;
+  try {
+    if (input.size() == 2) index = std::stoul(input[1]);
+  } catch (const std::exception &) {
+  }
+  bool removed = false;
+  config_->update([&](stream_config &config) {
+    if (index >= 1 && index <= config.sinks.size()) {
+      config.sinks.erase(config.sinks.begin() + (index - 1));
+      removed = true;
+    }
+  });
+  if (!removed) {
+    usage();
+    return 1;
+  }
   return 0;
 }
 
 unsigned program::set_background(const std::vector<std::string> &input) {
-  bg.clear();
-  animate = false;
   if (input.size() != 3) {
     std::cout << "Usage: set-mode external <image_file_path>" << std::endl;
     return 1;
@@ -221,35 +625,351 @@ unsigned program::set_background(const std::vector<std::string> &input) {
   std::string extension = filePath.extension().string();
 
   std::set<std::string> supportedImageFormats = {".png", ".jpeg", ".jpg"};
-  if (extension == ".ayuv") {
-    if (int errorcode = load(bg, input[2]) != 0) {
-      return errorcode;
-    }
-  } else if (supportedImageFormats.find(extension) != supportedImageFormats.end()) {
-    // Handle image file
-    std::ifstream file(background_file_path);
-    if (!file.good()) {
-      std::cerr << "Error opening file: " << background_file_path << std::endl;
-      return 1;
-    }
+  if (extension != ".ayuv" && supportedImageFormats.find(extension) == supportedImageFormats.end()) {
+    std::cerr << "Unsupported image format. The supported image formats are: .png, .jpeg, .jpg, and .ayuv."
+              << std::endl;
+    return 1;
+  }
+  std::ifstream file(background_file_path);
+  if (!file.good()) {
+    std::cerr << "Error opening file: " << background_file_path << std::endl;
+    return 1;
+  }
 
-    // Process image file using processImage function
+  // Decode and convert the image on the pool (or map it from the cache), the frames keep the current background until
+  // it is ready
+  std::cout << "Loading background: " << background_file_path << std::endl;
+  auto apply = switch_request();
+  pool_->submit([apply, background_file_path, w = src_w, h = src_h, sigma = sigma_bg_blur, cache = asset_cache_]() {
+    background_assets loaded;
     try {
-      std::vector<uint8_t> imageData = processImage(background_file_path);
-      convertRGBtoAYUV(imageData, bg);
+      loaded = load_background(background_file_path, w, h, sigma, *cache);
     } catch (const std::exception &e) {
       std::cerr << "Error processing image file: " << e.what() << std::endl;
+      return;
+    }
+    if (!loaded.image) {
+      return;
+    }
+    apply([&](stream_config &config) {
+      config.bg = loaded.image;
+      config.bg_blurred = loaded.blurred;
+      config.bg_file = background_file_path;
+      config.mode = segmentation_mode::external_background;
+      config.animate = false;
+    });
+    std::cout << "Background loaded: " << background_file_path << std::endl;
+  });
+  return 0;
+}
+
+unsigned program::set_governor(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < on | off > [ target_fps ]\n";
+    std::cout << "  Lowers the quality step by step when frames take longer than the frame budget, and raises it\n";
+    std::cout << "  again when there is room: fewer snowflakes, half resolution blur, a single mask blur, inference\n";
+    std::cout << "  every 2nd frame, the lite model, and inference every 3rd frame.\n";
+    std::cout << "  target_fps: frame rate to hold (default: 30)\n";
+  };
+  if (input.size() < 2 || input.size() > 3 || (input[1] != "on" && input[1] != "off")) {
+    usage();
+    return 1;
+  }
+  double target_fps = config_->latest().governor_fps;
+  try {
+    if (input.size() > 2) target_fps = std::stod(input[2]);
+  } catch (const std::exception &) {
+    usage();
+    return 1;
+  }
+  if (target_fps <= 0) {
+    usage();
+    return 1;
+  }
+  config_->update([&](stream_config &config) {
+    config.use_governor = input[1] == "on";
+    config.governor_fps = target_fps;
+    config.governor_generation++;
+  });
+  std::cout << "Quality governor: " << input[1] << " (target " << target_fps << " fps)" << std::endl;
+  return 0;
+}
+
+unsigned program::set_precision(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < float | compact >\n";
+    std::cout << "  float:   32-bit float mask and background planes (default)\n";
+    std::cout << "  compact: 16-bit mask and 8-bit background planes, a third of the memory traffic per frame\n";
+  };
+  if (input.size() != 2 || (input[1] != "float" && input[1] != "compact")) {
+    usage();
+    return 1;
+  }
+  config_->update([&](stream_config &config) {
+    config.compact = input[1] == "compact";
+  });
+  std::cout << "Precision: " << input[1] << std::endl;
+  return 0;
+}
+
+unsigned program::set_blur_cache(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < on | off >\n";
+    std::cout << "  Keep the blurred background of the previous frames and only blur the parts of the frame that\n";
+    std::cout << "  changed again, everything is blurred again every 150 frames.\n";
+  };
+  if (input.size() != 2 || (input[1] != "on" && input[1] != "off")) {
+    usage();
+    return 1;
+  }
+  config_->update([&](stream_config &config) {
+    config.use_blur_cache = input[1] == "on";
+  });
+  std::cout << "Blur cache: " << input[1] << std::endl;
+  return 0;
+}
+
+unsigned program::set_halo_free(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < on | off >\n";
+    std::cout << "  Blur only the background pixels, so the person does not leave a halo in the blurred background.\n";
+  };
+  if (input.size() != 2 || (input[1] != "on" && input[1] != "off")) {
+    usage();
+    return 1;
+  }
+  config_->update([&](stream_config &config) {
+    config.halo_free_blur = input[1] == "on";
+  });
+  std::cout << "Halo free blur: " << input[1] << std::endl;
+  return 0;
+}
+
+unsigned program::set_shm(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < on | off > [ mask ]\n";
+    std::cout << "  Also publish the frames in shared memory, for programs on this machine (see tools/shm_reader).\n";
+    std::cout << "  mask: publish the person mask of every frame along\n";
+  };
+  if (input.size() < 2 || input.size() > 3 || (input[1] != "on" && input[1] != "off") ||
+      (input.size() == 3 && input[2] != "mask")) {
+    usage();
+    return 1;
+  }
+  config_->update([&](stream_config &config) {
+    config.shm_output = input[1] == "on";
+    config.shm_masks = input.size() == 3;
+  });
+  std::cout << "Shared memory output: " << input[1] << " (" << shm_name() << (input.size() == 3 ? ", with masks" : "")
+            << ")" << std::endl;
+  return 0;
+}
+
+std::string program::shm_name() const {
+  return "/webcamvb-" + std::filesystem::path(out_filename).filename().string();
+}
+
+unsigned program::record(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < start <file> [ codec ] | stop >\n";
+    std::cout << "  Records the output to a file (.mkv, .mp4, .avi, ..), encoded on a thread of its own. Frames the\n";
+    std::cout << "  encoder cannot keep up with are left out of the recording, the output is never slowed down.\n";
+    std::cout << "  codec: encoder to use (e.g. libx264, ffv1, mjpeg), default: the first available of H.264, FFV1\n";
+    std::cout << "  and MJPEG\n";
+  };
+  if (input.size() >= 3 && input.size() <= 4 && input[1] == "start") {
+    if (recorder_.recording()) {
+      std::cout << "Already recording, stop first" << std::endl;
       return 1;
     }
-  } else {
-    std::cerr << "Unsupported image format. The supported image formats are: .png, .jpeg, .jpg, and .ayuv."
+    if (!recorder_.start(input[2], src_w, src_h, input.size() == 4 ? input[3] : "")) {
+      return 1;
+    }
+    std::cout << "Recording: " << input[2] << " (" << recorder_.codec() << ")" << std::endl;
+    return 0;
+  }
+  if (input.size() == 2 && input[1] == "stop") {
+    recorder_.stop();
+    std::cout << "Recording stopped: " << recorder_.recorded() << " frames, " << recorder_.dropped() << " dropped"
               << std::endl;
+    return 0;
+  }
+  usage();
+  return 1;
+}
+
+unsigned program::set_pacing(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " < fps | off >\n";
+    std::cout << "  Writes frames to the output device at a constant rate, from a timer thread: the last frame is\n";
+    std::cout << "  written again when no new one is ready, and frames overtaken by a newer one are dropped.\n";
+    std::cout << "  off: write every frame as soon as it is processed (default)\n";
+  };
+  double fps = 0;
+  try {
+    if (input.size() == 2 && input[1] != "off") fps = std::stod(input[1]);
+  } catch (const std::exception &) {
+    fps = -1;
+  }
+  if (input.size() != 2 || fps < 0 || fps > 240 || (fps == 0 && input[1] != "off")) {
+    usage();
     return 1;
   }
-  mode = segmentation_mode::external_background;
+  config_->update([&](stream_config &config) {
+    config.output_fps = fps;
+  });
+  if (fps > 0) {
+    std::cout << "Output pacing: " << fps << " fps" << std::endl;
+  } else {
+    std::cout << "Output pacing: off" << std::endl;
+  }
+  return 0;
+}
+
+unsigned program::pacing(const std::vector<std::string> &input) {
+  if (input.size() != 1) {
+    std::cout << "Usage: " << input[0] << "\n";
+    std::cout << "  Shows how evenly the frames were written since output pacing started (see set-pacing).\n";
+    return 1;
+  }
+  if (!pacer_.running()) {
+    std::cout << "Output pacing is not running." << std::endl;
+    return 1;
+  }
+  const pacing_stats stats = pacer_.stats();
+  std::cout << "Output pacing: " << stats.fps << " fps, " << stats.frames << " frames written (" << stats.repeated
+            << " repeated), " << stats.dropped << " dropped, " << stats.missed_ticks << " ticks missed\n";
+  std::cout << "  interval " << stats.mean_interval_ms << " ms (target " << 1000. / stats.fps << " ms), jitter "
+            << stats.jitter_ms << " ms, largest deviation " << stats.max_deviation_ms << " ms" << std::endl;
+  return 0;
+}
+
+unsigned program::bench(const std::vector<std::string> &input) {
+  const auto usage = [=]() {
+    std::cout << "Usage: " << input[0] << " [ frames ]\n";
+    std::cout << "  Runs the frame post-processing (mask upscale, blur, snowflakes, compositing) of the current mode\n";
+    std::cout << "  on synthetic frames, in float and compact precision, and reports time, memory and cache misses.\n";
+  };
+  int frames = 100;
+  try {
+    if (input.size() == 2) frames = std::stoi(input[1]);
+  } catch (const std::exception &) {
+    frames = 0;
+  }
+  if (input.size() > 2 || frames <= 0) {
+    usage();
+    return 1;
+  }
+  if (running_) {
+    std::cout << "stop first, the benchmark uses the buffers of the running pipeline." << std::endl;
+    return 1;
+  }
+
+  // synthetic input: a gradient frame, and a model output with a person shaped blob in the middle
+  model = models[model_selected];
+  roi = region{0, 0, src_w, src_h};
+  roi_tracker_.reset(src_w, src_h);
+  const int channels = model_selected == mlkit ? 1 : 2;
+  model_output.resize(model.width * model.height * channels);
+  for (int y = 0; y < model.height; y++) {
+    for (int x = 0; x < model.width; x++) {
+      const float dx = (x - model.width / 2.f) / (model.width / 4.f);
+      const float dy = (y - model.height * 0.6f) / (model.height / 2.f);
+      const bool person = dx * dx + dy * dy < 1.f;
+      float *out = model_output.data() + (y * model.width + x) * channels;
+      if (channels == 1) {
+        out[0] = person ? 1.f : 0.f;
+      } else {
+        out[0] = person ? -4.f : 4.f;
+        out[1] = -out[0];
+      }
+    }
+  }
+  std::vector<uint8_t> source(src_w * src_h * 3 / 2);
+  for (size_t i = 0; i < source.size(); i++) source[i] = uint8_t(i * 7 + i / src_w);
+  std::vector<uint8_t> frame(source.size());
+
+  const auto run_bench = [&](auto &planes, bool use_compact, const char *name) {
+    const pipeline_fn run = select_pipeline(use_compact);
+    // start from nothing, so the resident set grows by the working set of this layout
+    planes = std::decay_t<decltype(planes)>{};
+    vbg_blur_ = {};
+    const size_t rss_before = resident_bytes();
+    frame = source;
+    (this->*run)(frame.data());
+    const size_t rss_after = resident_bytes();
+
+    cache_miss_counter misses;
+    misses.start();
+    const auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+      frame = source;
+      (this->*run)(frame.data());
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    const uint64_t miss_count = misses.stop();
+
+    std::cout << name << ": " << (ms / frames) << " ms per frame, planes " << (planes.bytes() / 1024) << " KiB, RSS +"
+              << ((rss_after > rss_before ? rss_after - rss_before : 0) / 1024) << " KiB, cache misses per frame ";
+    if (misses.valid()) {
+      std::cout << (miss_count / frames) << std::endl;
+    } else {
+      std::cout << "n/a (perf events not available)" << std::endl;
+    }
+    planes = std::decay_t<decltype(planes)>{};
+  };
+  // the frames are all the same, with the blur cache nothing but the first frame would be blurred
+  stream_config config = config_->latest();
+  config.use_blur_cache = false;
+  frame_config_ = &config;
+  std::cout << "Benchmark: " << frames << " frames of " << src_w << "x" << src_h << ", " << simd_level() << std::endl;
+  run_bench(float_planes_, false, "float  ");
+  run_bench(compact_planes_, true, "compact");
+  model_output.clear();
+  frame_config_ = nullptr;
   return 0;
 }
 
+void program::govern(double frame_ms) {
+  const bool use_governor = frame_config_->use_governor;
+  // every set-governor starts over from the full quality, with the new target
+  if (governor_generation_ != frame_config_->governor_generation) {
+    governor_generation_ = frame_config_->governor_generation;
+    governor_.reset();
+    governor_.target_fps = frame_config_->governor_fps;
+  }
+  if (use_governor && governor_.update(frame_ms)) {
+    std::cout << "Quality level " << governor_.level() << "/" << (governor_.levels() - 1) << " ("
+              << governor_.average_ms() << " ms per frame, budget " << governor_.budget_ms() << " ms)" << std::endl;
+  }
+  const size_t level = use_governor ? governor_.level() : 0;
+  if (level == applied_level_) {
+    return;
+  }
+  // while the model of an earlier level is still loading, the new level waits for a later frame: the frame thread
+  // never waits for the pool, which also loads the chunks and decodes the backgrounds
+  if (governor_model_.valid() && !is_ready(governor_model_)) {
+    return;
+  }
+  applied_level_ = level;
+  quality_ = use_governor ? governor_.settings() : quality_level{};
+
+  // the model is swapped the same way as with set-model, the current one keeps running until the other is loaded
+  const auto switch_model = [this](segmentation_model selected) {
+    governor_model_ = pool_->submit([this, selected]() {
+      queue_model(selected);
+    });
+  };
+  if (quality_.lite_model && model_selected == google_meet_full) {
+    governor_lowered_model_ = true;
+    switch_model(google_meet_lite);
+  } else if (!quality_.lite_model && governor_lowered_model_) {
+    governor_lowered_model_ = false;
+    // unless the user picked another model in the meantime
+    if (model_selected == google_meet_lite) switch_model(google_meet_full);
+  }
+}
+
 void program::start_console() {
   cr::Console c("cam> ");
 
@@ -257,9 +977,27 @@ void program::start_console() {
   c.registerCommand("set-cam", std::bind(&program::set_cam, this, std::placeholders::_1));
   c.registerCommand("set-mode", std::bind(&program::set_mode, this, std::placeholders::_1));
   c.registerCommand("set-model", std::bind(&program::set_model, this, std::placeholders::_1));
+  c.registerCommand("set-roi", std::bind(&program::set_roi, this, std::placeholders::_1));
+  c.registerCommand("set-gating", std::bind(&program::set_gating, this, std::placeholders::_1));
+  c.registerCommand("set-governor", std::bind(&program::set_governor, this, std::placeholders::_1));
+  c.registerCommand("set-precision", std::bind(&program::set_precision, this, std::placeholders::_1));
+  c.registerCommand("set-blur-cache", std::bind(&program::set_blur_cache, this, std::placeholders::_1));
+  c.registerCommand("set-halo-free", std::bind(&program::set_halo_free, this, std::placeholders::_1));
+  c.registerCommand("set-shm", std::bind(&program::set_shm, this, std::placeholders::_1));
+  c.registerCommand("record", std::bind(&program::record, this, std::placeholders::_1));
+  c.registerCommand("set-pacing", std::bind(&program::set_pacing, this, std::placeholders::_1));
+  c.registerCommand("pacing", std::bind(&program::pacing, this, std::placeholders::_1));
+  c.registerCommand("bench", std::bind(&program::bench, this, std::placeholders::_1));
   c.registerCommand("start", std::bind(&program::start, this, std::placeholders::_1));
   c.registerCommand("stop", std::bind(&program::stop, this, std::placeholders::_1));
+  c.registerCommand("pause", std::bind(&program::pause, this, std::placeholders::_1));
   c.registerCommand("preview", std::bind(&program::preview, this, std::placeholders::_1));
+  c.registerCommand("add-stream", std::bind(&program::add_stream, this, std::placeholders::_1));
+  c.registerCommand("list-streams", std::bind(&program::list_streams, this, std::placeholders::_1));
+  c.registerCommand("remove-stream", std::bind(&program::remove_stream, this, std::placeholders::_1));
+  c.registerCommand("add-sink", std::bind(&program::add_sink, this, std::placeholders::_1));
+  c.registerCommand("list-sinks", std::bind(&program::list_sinks, this, std::placeholders::_1));
+  c.registerCommand("remove-sink", std::bind(&program::remove_sink, this, std::placeholders::_1));
   c.executeCommand("help");
 
   int retCode;
@@ -277,9 +1015,7 @@ void program::start_console() {
 }
 
 int program::run() {
-  load_tensorflow_model();
-
-  // The rest of the run function is based on the remuxing.c example provided by ffmpeg
+  // The run function is based on the remuxing.c example provided by ffmpeg
 
   AVOutputFormat *ofmt = NULL;
   AVFormatContext *ifmt_ctx = NULL, *ofmt_ctx = NULL;
@@ -294,6 +1030,12 @@ int program::run() {
 
   AVPixelFormat video_format = AV_PIX_FMT_NONE;
 
+  // Wait until ffmpeg feeds the input device (the model and backgrounds keep loading meanwhile)
+  if (!wait_for_feed()) {
+    fprintf(stderr, "Camera feed '%s' did not start\n", camera_device.c_str());
+    return 1;
+  }
+
   // Specify v4l2 as the input format (cannot be detected from filename /dev/videoX)
   AVInputFormat *input_format = av_find_input_format("v4l2");
   if ((ret = avformat_open_input(&ifmt_ctx, in_filename.c_str(), input_format, 0)) < 0) {
@@ -385,7 +1127,14 @@ int program::run() {
   }
 
   while (!stop_) {
-    reset();
+    if (paused_) {
+      pacer_.stop();
+      std::unique_lock<std::mutex> lock(pause_mut_);
+      pause_cv_.wait(lock, [&]() {
+        return !paused_ || stop_;
+      });
+      continue;
+    }
 
     AVStream *in_stream, *out_stream;
 
@@ -410,31 +1159,54 @@ int program::run() {
     pkt.pos = -1;
     // log_packet(ofmt_ctx, &pkt, "out");
 
-    static AVPacket *pkt_copy_ = nullptr;
-    if (pkt_copy_ == nullptr) {
-      pkt_copy_ = new AVPacket;
-      av_new_packet(pkt_copy_, pkt.size);
+    // Frames are processed in place; the demuxer normally hands us the only reference to its buffer, if not the
+    // pixels move to a pooled buffer first
+    if (!frames_.make_writable(pkt)) {
+      av_packet_unref(&pkt);
+      ret = AVERROR(ENOMEM);
+      break;
     }
 
-    av_copy_packet(pkt_copy_, &pkt);
-    AVPacket &pkt_copy = *pkt_copy_;
+    // Swap in a newly selected model, loaded backgrounds and the latest settings at the frame boundary
+    apply_pending_model();
+    use_loaded_assets();
+    frame_config_ = &config_->read();
 
-    process_frame(pkt);
+    // Until the model is loaded, the camera frames are passed through as-is
+    if (model_ready()) {
+      const auto begin = std::chrono::steady_clock::now();
+      process_frame(pkt);
+      govern(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    }
+    publish_shared(pkt);
+    if (recorder_.recording() && pkt.size >= src_w * src_h * 3 / 2) {
+      recorder_.push(pkt.data);
+    }
+    write_sinks(pkt);
 
-    ret = av_write_frame(ofmt_ctx, &pkt);
-    if (ret < 0) {
-      fprintf(stderr, "Error muxing packet\n");
-      break;
+    // Frames go out as soon as they are processed, or at a constant rate from the pacer thread (set-pacing)
+    if (frame_config_->output_fps > 0) {
+      if (!pacer_.running() || pacer_.fps() != frame_config_->output_fps) {
+        pacer_.start(ofmt_ctx, frame_config_->output_fps);
+      }
+      pacer_.submit(pkt);
+    } else {
+      pacer_.stop();
+      ret = av_write_frame(ofmt_ctx, &pkt);
+      if (ret < 0) {
+        fprintf(stderr, "Error muxing packet\n");
+        break;
+      }
     }
     av_packet_unref(&pkt);
-    av_packet_unref(&pkt_copy);
-
-    // TODO: make optional, chromium doesn't seem to handle too many frames very well..
-    // std::this_thread::sleep_for(std::chrono::milliseconds(50));
   }
 
+  pacer_.stop();
   av_write_trailer(ofmt_ctx);
 end:
+  shm_out_.close();
+  sinks_.clear();
+  recorder_.stop();
 
   avformat_close_input(&ifmt_ctx);
 
@@ -451,279 +1223,436 @@ end:
   return 0;
 }
 
+void program::write_sinks(const AVPacket &pkt) {
+  const std::vector<sink_spec> &specs = frame_config_->sinks;
+  // open and close the sinks as they are added and removed, outputs that failed to open are not retried
+  const bool changed = sinks_.size() != specs.size() || !std::equal(specs.begin(),
+                                                                     specs.end(),
+                                                                     sinks_.begin(),
+                                                                     [](const sink_spec &spec, const auto &sink) {
+                                                                       return sink->spec() == spec;
+                                                                     });
+  if (changed) {
+    std::vector<std::unique_ptr<output_sink>> sinks;
+    for (const sink_spec &spec : specs) {
+      auto kept = std::find_if(sinks_.begin(), sinks_.end(), [&](const auto &sink) {
+        return sink && sink->spec() == spec;
+      });
+      if (kept != sinks_.end()) {
+        sinks.push_back(std::move(*kept));
+      } else {
+        sinks.push_back(std::make_unique<output_sink>(spec));
+        sinks.back()->open();
+      }
+    }
+    sinks_ = std::move(sinks);
+  }
+  if (sinks_.empty() || pkt.size < src_w * src_h * 3 / 2) {
+    return;
+  }
+  for (auto &sink : sinks_) sink->write(pkt.data, src_w, src_h);
+}
+
+void program::publish_shared(const AVPacket &pkt) {
+  // the ring is created and closed here on the frame thread, following the config
+  if (!frame_config_->shm_output) {
+    shm_out_.close();
+    return;
+  }
+  if (!shm_out_.is_open() || shm_out_.has_masks() != frame_config_->shm_masks) {
+    if (!shm_out_.open(shm_name(), src_w, src_h, frame_config_->shm_masks)) {
+      config_->update([](stream_config &config) {
+        config.shm_output = false;
+      });
+      return;
+    }
+  }
+  if (pkt.size < src_w * src_h * 3 / 2) {
+    return;
+  }
+  // there is a mask of this frame once the model runs, except when passing the frames through
+  const bool masked = model_loaded_ && !model_output.empty() && frame_config_->mode != segmentation_mode::bypass;
+  if (frame_config_->compact) {
+    shm_out_.publish(pkt.data, pkt.pts, masked ? compact_planes_.mask.data() : nullptr);
+  } else {
+    shm_out_.publish(pkt.data, pkt.pts, masked ? float_planes_.mask.data() : nullptr);
+  }
+}
+
 void program::load_tensorflow_model() {
-  // Load model
-  tflite_model =
-      std::unique_ptr<tflite::FlatBufferModel>(tflite::FlatBufferModel::BuildFromFile(model.filename.c_str()));
-  if (!tflite_model) {
+  // Load model, or reuse it if another stream already did
+  if (!model_pool_->preload(model.filename)) {
     printf("Failed to model\n");
     exit(0);
   } else {
     printf("Loaded model\n");
   }
+}
+
+void program::process_frame(AVPacket &pkt) {
+  // std::vector<float> pixels;
 
-  resolver = std::make_unique<tflite::ops::builtin::BuiltinOpResolver>();
-  // Custom op for Google Meet network
-  resolver->AddCustom("Convolution2DTransposeBias", mediapipe::tflite_operations::RegisterConvolution2DTransposeBias());
-  builder.reset(new tflite::InterpreterBuilder(*tflite_model, *resolver));
-  (*builder)(&interpreter);
+  // bypass passes the frames through, no pipeline step uses a mask. The mask from before is dropped, so leaving bypass
+  // runs the model on the first frame again.
+  if (frame_config_->mode == segmentation_mode::bypass) {
+    if (!model_output.empty()) {
+      model_output.clear();
+      scene_change_.reset(src_w, src_h);
+    }
+    return;
+  }
 
-  // Resize input tensors, if desired.
-  if (interpreter->AllocateTensors() != kTfLiteOk) {
-    fprintf(stderr, "Something wrong");
-    exit(1);
+  // Skip inference if the frame barely changed (or the governor lowered the inference rate), the previous mask is
+  // reused then
+  const bool due = ++frames_since_inference_ >= quality_.inference_interval || model_output.empty();
+  scene_change_.threshold = frame_config_->gating_threshold;
+  scene_change_.max_stale = frame_config_->gating_max_stale;
+  if (due && (!frame_config_->use_gating || scene_change_.needs_inference(pkt.data))) {
+    frames_since_inference_ = 0;
+    // Interpreters are shared with other streams, only hold on to one during inference
+    interpreter = model_pool_->acquire(model.filename);
+    if (interpreter) {
+      // Fill input tensor with RGB values
+      fill_input_tensor(pkt);
+
+      // Run inference
+      interpreter->Invoke();
+
+      const TfLiteTensor *output = interpreter->output_tensor(0);
+      const float *output_data = interpreter->typed_output_tensor<float>(0);
+      model_output.assign(output_data, output_data + output->bytes / sizeof(float));
+
+      model_pool_->release(model.filename, std::move(interpreter));
+      inference_failed_ = false;
+    } else if (!inference_failed_) {
+      // the previous mask is kept, and the next inference tried at the next due frame
+      std::cout << "Warning: no interpreter for " << model.filename << ", keeping the previous mask" << std::endl;
+      inference_failed_ = true;
+    }
   }
+  // without any mask yet the frame is passed through
+  if (model_output.empty()) {
+    return;
+  }
+
+  // the pipeline is picked once per frame, switching the mode or model in the console takes effect at the next frame
+  (this->*select_pipeline(frame_config_->compact))(pkt.data);
 }
 
-void program::reset() {
-  mask.clear();
-  background_y.clear();
-  background_u.clear();
-  background_v.clear();
+namespace {
+
+constexpr size_t mode_count = size_t(segmentation_mode::depth_of_field) + 1;
+
+template <mask_layout Layout, bool Compact, size_t... Modes>
+constexpr std::array<program::pipeline_fn, mode_count> pipelines_per_mode(std::index_sequence<Modes...>) {
+  return {&program::pipeline<segmentation_mode(Modes), Layout, Compact>...};
 }
 
-void program::process_frame(AVPacket &pkt_copy) {
-  // std::vector<float> pixels;
+template <mask_layout Layout, bool Compact>
+constexpr std::array<program::pipeline_fn, mode_count> pipelines_per_mode() {
+  return pipelines_per_mode<Layout, Compact>(std::make_index_sequence<mode_count>{});
+}
+
+// Frame pipelines compiled for every mode, model output layout and precision: [compact][layout][mode]
+constexpr std::array<std::array<std::array<program::pipeline_fn, mode_count>, 2>, 2> pipelines = {{
+    {{pipelines_per_mode<mask_layout::logits, false>(), pipelines_per_mode<mask_layout::probability, false>()}},
+    {{pipelines_per_mode<mask_layout::logits, true>(), pipelines_per_mode<mask_layout::probability, true>()}},
+}};
+
+}  // namespace
+
+program::pipeline_fn program::select_pipeline(bool use_compact) const {
+  const mask_layout layout = model_selected == mlkit ? mask_layout::probability : mask_layout::logits;
+  return pipelines[use_compact][size_t(layout)][frame_config_->mode];
+}
+
+template <segmentation_mode Mode, mask_layout Layout, bool Compact>
+void program::pipeline(uint8_t *frame) {
+  if constexpr (Compact) {
+    process_planes<Mode, Layout>(compact_planes_, frame);
+  } else {
+    process_planes<Mode, Layout>(float_planes_, frame);
+  }
+}
 
-  // Fill input tensor with RGB values
-  fill_input_tensor(pkt_copy);
+template <segmentation_mode Mode, mask_layout Layout, typename Planes>
+void program::process_planes(Planes &planes, uint8_t *frame) {
+  if constexpr (Mode == bypass) {
+    return;
+  }
+  // which steps this mode needs, everything else is left out of its pipeline
+  constexpr bool background_planes =
+      Mode == blur_background || Mode == snowflakes || Mode == snowflakes_blur || Mode == depth_of_field;
+  constexpr bool blurred_planes = background_planes && Mode != snowflakes;
+  constexpr bool image_background =
+      Mode == virtual_background || Mode == virtual_background_blurred || Mode == external_background;
 
-  // Run inference
-  interpreter->Invoke();
+  // every frame overwrites the planes completely, this only allocates when the frame size changes
+  planes.resize(src_w * src_h);
 
   // Upscale resulting segregation mask
-  upscale_segregation_mask(pkt_copy);
-
-  // We need two copies of the mask for blurring
-  blur_yuv();
-
-  set_virtual_background_source();
-
-  blur_virtual_background_itself();
-
-  // blur the mask as well, since we scaled it up
-  fast_gaussian_blur(mask_pixels, mask_out, src_w, src_h, sigma_segmask);
-
-  draw_snowflakes(pkt_copy);
-
-  float *bg_y = background_y.data();
-  float *bg_u = background_u.data();
-  float *bg_v = background_v.data();
-
-  for (int y = 0; y < src_h; y++) {
-    for (int x = 0; x < src_w; x++) {
-      int index_Y = y * src_w + x;
-      int index_U = (src_w * src_h) + (y / 2) * (src_w / 2) + x / 2;
-      int index_V = (int)((src_w * src_h) * 1.25 + (y / 2) * (src_w / 2) + x / 2);
-
-      float mask_alpha_ratio = *mask_out_2++;
-      const auto val = mask_alpha_ratio * 255.f;
-      float bg_alpha_ratio = 1.0f - mask_alpha_ratio;
-
-      // blend person on top of background using mask
-      switch (mode) {
-        case white_background:
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(0xFF * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(0x80 * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(0x80 * bg_alpha_ratio);
-          break;
-        case black_background:
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(0x00 * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(0x80 * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(0x80 * bg_alpha_ratio);
-          break;
-        case blur_background:
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(255 * *bg_y++ * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(255 * *bg_u++ * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(255 * *bg_v++ * bg_alpha_ratio);
-          break;
-        case virtual_background:
-          vbg++;  // skip alpha channel
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          break;
-        case virtual_background_blurred:
-          vbg++;  // skip alpha channel
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          break;
-        case snowflakes: {
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(*bg_y++ * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(*bg_u++ * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(*bg_v++ * bg_alpha_ratio);
-          break;
-        }
-        case snowflakes_blur: {
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(255 * *bg_y++ * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(255 * *bg_u++ * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(255 * *bg_v++ * bg_alpha_ratio);
-          break;
-        }
-        case external_background: {
-          vbg++;  // skip alpha channel
-          pkt_copy.data[index_Y] = (pkt_copy.data[index_Y] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          pkt_copy.data[index_U] = (pkt_copy.data[index_U] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          pkt_copy.data[index_V] = (pkt_copy.data[index_V] * mask_alpha_ratio) + float(*vbg++ * bg_alpha_ratio);
-          break;
-         }
+  upscale_segregation_mask<Layout>(planes);
+
+  // Background Y, U and V for blurring, this is the snapshot of the original pixels: snowflakes and compositing modify
+  // the frame in place afterwards
+  if constexpr (background_planes) {
+    yuv420p_to_planes(frame, src_w, src_h, planes.y.data(), planes.u.data(), planes.v.data());
+  }
+
+  // Blur the mask, and find the edges of the person in it
+  blur_mask(planes);
+  spans_.build(planes.mask.data(), src_w, src_h);
+
+  // Blur the background, unless the person covers all of it
+  if constexpr (blurred_planes) {
+    if (!spans_.all_person()) {
+      blur_yuv<Mode>(planes, frame);
+    }
+  }
+
+  if constexpr (image_background) {
+    const bool blurred = set_virtual_background_source(Mode == virtual_background_blurred);
+    if constexpr (Mode == virtual_background_blurred) {
+      if (!blurred && !spans_.all_person()) {
+        blur_virtual_background_itself();
       }
     }
   }
+
+  if constexpr (Mode == snowflakes || Mode == snowflakes_blur) {
+    draw_snowflakes(planes, frame);
+  }
+
+  // blend person on top of background using mask
+  composite_frame<Mode>(planes, frame);
 }
 
-void program::set_virtual_background_source() {
-  if (!animate) {
-    vbg = bg.data();
-    return;
+template <segmentation_mode Mode, typename Planes>
+void program::composite_frame(Planes &planes, uint8_t *frame) {
+  // only the edges of the person are blended, see mask_spans
+  const auto *alpha = planes.mask.data();
+  if constexpr (Mode == white_background) {
+    composite_solid(frame, alpha, src_w, src_h, spans_, 0xFF, 0x80, 0x80);
+  } else if constexpr (Mode == black_background) {
+    composite_solid(frame, alpha, src_w, src_h, spans_, 0x00, 0x80, 0x80);
+  } else if constexpr (Mode == blur_background || Mode == snowflakes_blur || Mode == depth_of_field) {
+    composite_planes(frame, alpha, src_w, src_h, spans_, planes.y.data(), planes.u.data(), planes.v.data(), 1.f);
+  } else if constexpr (Mode == snowflakes) {
+    // the (unblurred) snowflakes background has always been blended unscaled, i.e. almost black
+    composite_planes(frame,
+                     alpha,
+                     src_w,
+                     src_h,
+                     spans_,
+                     planes.y.data(),
+                     planes.u.data(),
+                     planes.v.data(),
+                     1.f / 255.f);
+  } else if constexpr (Mode == virtual_background || Mode == virtual_background_blurred ||
+                       Mode == external_background) {
+    composite_ayuv(frame, alpha, src_w, src_h, spans_, vbg);
   }
-  static size_t index = 0;
-  if (index == 750) {
-    index = 0;
-  };
-  vbg = anim_bg[index].data();
-  index++;
 }
 
-void program::blur_virtual_background_itself() {
-  if (mode == virtual_background_blurred) {
-    std::vector<float> bg_y, bg_u, bg_v;
-
-    auto vb = vbg;
-    for (int i = 0; i < (src_w * src_h); i++) {
-      vb++;
-      bg_y.push_back(*vb++ / 255.);
-      bg_u.push_back(*vb++ / 255.);
-      bg_v.push_back(*vb++ / 255.);
-    }
-    const auto blur_channel = [&](std::vector<float> &channel) {
-      auto channel_copy = channel;
-      float *bg1f = (float *)channel.data();
-      float *bg2f = (float *)channel_copy.data();
-      fast_gaussian_blur(bg1f, bg2f, src_w, src_h, sigma_bg_blur);
+bool program::set_virtual_background_source(bool blurred) {
+  if (frame_config_->animate && anim_bg->ready) {
+    if (anim_index == 750) {
+      anim_index = 0;
     };
-    blur_channel(bg_y);
-    blur_channel(bg_u);
-    blur_channel(bg_v);
-
-    // read back
-    vb = vbg;
-    for (size_t i = 0; i < bg_y.size(); i++) {
-      vb++;                    // a
-      *vb++ = bg_y[i] * 255.;  // y
-      *vb++ = bg_u[i] * 255.;  // u
-      *vb++ = bg_v[i] * 255.;  // v
-    }
+    vbg = anim_bg->frames[anim_index].data();
+    anim_index++;
+    return false;
   }
+  // not animated, or the animation is still loading: use the static background, or a placeholder until that one is
+  // loaded. The static background comes pre-blurred as well.
+  if (blurred && frame_config_->bg_blurred) {
+    vbg = frame_config_->bg_blurred.get();
+    return true;
+  }
+  vbg = frame_config_->bg ? frame_config_->bg.get() : placeholder_bg.data();
+  return false;
 }
 
-void program::blur_yuv() {
-  mask2 = mask;  // We need two copies for blurring the bg as well
-  mask_out = mask2.data();
-  mask_out_2 = mask2.data();
-  const auto blur_channel = [&](std::vector<float> &channel) {
-    auto channel2 = channel;
-    float *bg_y = channel.data();
-    float *bg_y2 = channel2.data();
-    fast_gaussian_blur(bg_y, bg_y2, src_w, src_h, sigma_bg_blur);
-  };
-  if (mode != segmentation_mode::snowflakes) {
-    blur_channel(background_y);
-    blur_channel(background_u);
-    blur_channel(background_v);
-  }
-  // gaussian the mask
-  mask_pixels = mask.data();
-  fast_gaussian_blur(mask_pixels, mask_out, src_w, src_h, sigma_segmask);
-}
-
-void program::upscale_segregation_mask(const AVPacket &pkt_copy) {
-  float *output = interpreter->typed_output_tensor<float>(0);
-  for (int y = 0; y < src_h; y++) {
-    for (int x = 0; x < src_w; x++) {
-      const int src_y = y * (model.height / float(src_h));
-      const int src_x = x * (model.width / float(src_w));
-      const auto src_offset = (src_y * model.width) + src_x;
-
-      const auto val = ([&]() -> uint8_t {
-        switch (model_selected) {
-          case mlkit: {
-            // Index into the right location in output
-            const auto person = *(output + src_offset);
-            return (255 * person);
-            break;
-          }
-          case google_meet_full:
-          case google_meet_lite:
-            // Index into the right location in output
-            const auto bg = *(output + src_offset * 2);
-            const auto person = *(output + src_offset * 2 + 1);
-            const auto shift = std::max(bg, person);
-            const auto backgroundExp = exp(bg - shift);
-            const auto personExp = exp(person - shift);
-            // Sets only the alpha component of each pixel
-            return (255 * personExp) / (backgroundExp + personExp);  // softmax
-            break;
-        }
-      })();
-      mask.push_back(float(val) / 255.0f);
-
-      // Background Y for blurring
-      int index_Y = y * src_w + x;
-      int index_U = (src_w * src_h) + (y / 2) * (src_w / 2) + x / 2;
-      int index_V = (int)((src_w * src_h) * 1.25 + (y / 2) * (src_w / 2) + x / 2);
-      background_y.push_back(pkt_copy.data[index_Y] / 255.);
-      background_u.push_back(pkt_copy.data[index_U] / 255.);
-      background_v.push_back(pkt_copy.data[index_V] / 255.);
-    }
+void program::blur_virtual_background_itself() {
+  // the background is shared with the other frames and streams, it is blurred into a copy
+  const size_t pixels = size_t(src_w) * src_h;
+  std::vector<float> &bg_y = vbg_planes_[0], &bg_u = vbg_planes_[1], &bg_v = vbg_planes_[2];
+  bg_y.resize(pixels);
+  bg_u.resize(pixels);
+  bg_v.resize(pixels);
+  for (size_t i = 0; i < pixels; i++) {
+    bg_y[i] = vbg[i * 4 + 1] / 255.;
+    bg_u[i] = vbg[i * 4 + 2] / 255.;
+    bg_v[i] = vbg[i * 4 + 3] / 255.;
+  }
+  blur_bg_plane(bg_y, vbg_blur_, sigma_bg_blur);
+  blur_bg_plane(bg_u, vbg_blur_, sigma_bg_blur);
+  blur_bg_plane(bg_v, vbg_blur_, sigma_bg_blur);
+
+  vbg_blurred_.resize(pixels * 4);
+  for (size_t i = 0; i < pixels; i++) {
+    vbg_blurred_[i * 4] = vbg[i * 4];                   // a
+    vbg_blurred_[i * 4 + 1] = uint8_t(bg_y[i] * 255.);  // y
+    vbg_blurred_[i * 4 + 2] = uint8_t(bg_u[i] * 255.);  // u
+    vbg_blurred_[i * 4 + 3] = uint8_t(bg_v[i] * 255.);  // v
   }
+  vbg = vbg_blurred_.data();
 }
 
-void program::fill_input_tensor(const AVPacket &pkt_copy) {
-  auto *input = interpreter->typed_tensor<float>(0);
-  const float inv_width = 1.0f / model.width;
-  const float inv_height = 1.0f / model.height;
+template <segmentation_mode Mode, typename Planes>
+void program::blur_yuv(Planes &planes, const uint8_t *frame) {
+  if constexpr (Mode == depth_of_field) {
+    blur_depth_of_field(planes);
+    return;
+  }
+  if (frame_config_->halo_free_blur) {
+    // the weights follow the mask, which changes without the frame changing, so nothing can be kept
+    planes.changes.invalidate();
+    blur_halo_free(planes);
+    return;
+  }
+  // with the blur cache only the tiles that changed since they were last blurred are blurred again
+  const tile_changes *changes = nullptr;
+  if (frame_config_->use_blur_cache) {
+    const int scale = quality_.pyramid_blur ? 2 : 1;
+    planes.changes.update(frame, src_w, src_h, scale, sigma_bg_blur / scale);
+    changes = &planes.changes;
+  } else {
+    planes.changes.invalidate();
+  }
+  blur_bg_plane(planes.y, planes.blur, sigma_bg_blur, changes, &planes.y_blurred);
+  blur_bg_plane(planes.u, planes.blur, sigma_bg_blur, changes, &planes.u_blurred);
+  blur_bg_plane(planes.v, planes.blur, sigma_bg_blur, changes, &planes.v_blurred);
+}
 
-  const float kRedCoeff = 1.402f;
-  const float kGreenCoeff1 = 0.344f;
-  const float kGreenCoeff2 = 0.714f;
-  const float kBlueCoeff = 1.772f;
+template <typename Planes>
+void program::blur_depth_of_field(Planes &planes) {
+  // the further away from the person the blurrier, up to a box of 3 sigma radius at a quarter of the frame width.
+  // The radius changes per pixel, so the planes are blurred as box averages from summed-area tables.
+  distance_to_person(planes.mask.data(), src_w, src_h, person_distance_);
+  sat_.build(planes.y.data(), planes.u.data(), planes.v.data(), src_w, src_h);
+  sat_.blur(person_distance_.data(),
+            int(3 * sigma_bg_blur),
+            src_w / 4,
+            planes.y.data(),
+            planes.u.data(),
+            planes.v.data());
+}
 
-  for (int y = 0; y < model.height; y++) {
-    const int src_y = static_cast<int>(y * inv_height * src_h);
-    const int src_y_div_2 = src_y / 2;
+template <typename Planes>
+void program::blur_halo_free(Planes &planes) {
+  const bool half = quality_.pyramid_blur;
+  normalized_blur_.pack(planes.mask.data(), planes.y.data(), planes.u.data(), planes.v.data(), src_w, src_h, half);
+  normalized_blur_.blur(half ? sigma_bg_blur / 2 : sigma_bg_blur);
+
+  auto &buffers = planes.blur;
+  int channel = 0;
+  for (auto *plane : {&planes.y, &planes.u, &planes.v}) {
+    if (half) {
+      buffers.half.resize(normalized_blur_.width() * normalized_blur_.height());
+      normalized_blur_.unpack(channel, buffers.half.data());
+      upsample_2x(buffers.half.data(), src_w, src_h, plane->data());
+    } else {
+      normalized_blur_.unpack(channel, plane->data());
+    }
+    channel++;
+  }
+}
 
-    for (int x = 0; x < model.width; x++) {
-      const int src_x = static_cast<int>(x * inv_width * src_w);
-      const int src_x_div_2 = src_x / 2;
+template <typename Planes>
+void program::blur_mask(Planes &planes) {
+  // gaussian the mask, since we scaled it up, a second pass (unless the quality governor skips it) smooths the
+  // edges further
+  blur_plane(planes.mask, planes.mask_blur, sigma_segmask);
+  if (!quality_.single_mask_blur) {
+    blur_plane(planes.mask, planes.mask_blur, sigma_segmask);
+  }
+}
 
-      const int index_Y = src_y * src_w + src_x;
-      const int index_U = (src_w * src_h) + (src_y_div_2) * (src_w / 2) + src_x_div_2;
-      const int index_V = static_cast<int>((src_w * src_h) * 1.25 + (src_y_div_2) * (src_w / 2) + src_x_div_2);
+template <typename T>
+void program::blur_plane(std::vector<T> &plane, blur_buffers<T> &buffers, float sigma) {
+  // the blurred result ends up in the input buffer, the other one is scratch space that is fully overwritten
+  buffers.scratch.resize(plane.size());
+  T *in = plane.data();
+  T *out = buffers.scratch.data();
+  fast_gaussian_blur(in, out, src_w, src_h, sigma);
+}
 
-      const int Y = pkt_copy.data[index_Y];
-      const int U = pkt_copy.data[index_U];
-      const int V = pkt_copy.data[index_V];
+template <typename T>
+void program::blur_bg_plane(std::vector<T> &plane,
+                            blur_buffers<T> &buffers,
+                            float sigma,
+                            const tile_changes *changes,
+                            std::vector<T> *blurred) {
+  if (!quality_.pyramid_blur) {
+    if (changes) {
+      blur_changed_tiles(*changes, plane.data(), src_w, src_h, sigma, *blurred, buffers.tile, buffers.tile_scratch);
+    } else {
+      blur_plane(plane, buffers, sigma);
+    }
+    return;
+  }
+  // blur at half resolution with half the sigma, a quarter of the work for nearly the same (already blurry) result
+  const int half_w = src_w / 2, half_h = src_h / 2;
+  buffers.half.resize(half_w * half_h);
+  buffers.half_scratch.resize(half_w * half_h);
+  downsample_2x(plane.data(), src_w, src_h, buffers.half.data());
+  if (changes) {
+    blur_changed_tiles(*changes,
+                       buffers.half.data(),
+                       half_w,
+                       half_h,
+                       sigma / 2,
+                       *blurred,
+                       buffers.tile,
+                       buffers.tile_scratch);
+  } else {
+    T *in = buffers.half.data();
+    T *out = buffers.half_scratch.data();
+    fast_gaussian_blur(in, out, half_w, half_h, sigma / 2);
+  }
+  upsample_2x(buffers.half.data(), src_w, src_h, plane.data());
+}
 
-      const int R = Y + static_cast<int>(kRedCoeff * (V - 128));
-      const int G = Y - static_cast<int>(kGreenCoeff1 * (U - 128) + kGreenCoeff2 * (V - 128));
-      const int B = Y + static_cast<int>(kBlueCoeff * (U - 128));
+template <mask_layout Layout, typename Planes>
+void program::upscale_segregation_mask(Planes &planes) {
+  const int model_pixels = model.width * model.height;
+  const float *person = model_output.data();
+  if constexpr (Layout == mask_layout::logits) {
+    // google meet models output (background, person) logits per pixel
+    model_mask.resize(model_pixels);
+    softmax_person(model_output.data(), model_mask.data(), model_pixels);
+    person = model_mask.data();
+  }
+  upscale_mask(person, model.width, model.height, roi, planes.mask.data(), src_w, src_h);
 
-      *input++ = static_cast<float>(R) / 255.0f;
-      *input++ = static_cast<float>(G) / 255.0f;
-      *input++ = static_cast<float>(B) / 255.0f;
-    }
+  // the region for the next frame follows the person in this mask
+  if (frame_config_->use_roi) {
+    roi_tracker_.update(planes.mask.data());
+  } else {
+    roi_tracker_.reset(src_w, src_h);
   }
 }
 
-void program::draw_snowflakes(AVPacket &pkt_copy) {
-  if (mode != segmentation_mode::snowflakes && mode != segmentation_mode::snowflakes_blur) {
-    return;
+void program::fill_input_tensor(const AVPacket &pkt) {
+  roi = frame_config_->use_roi ? roi_tracker_.current() : region{0, 0, src_w, src_h};
+  tensor_fill_.configure(src_w, src_h, roi, model.width, model.height);
+
+  const TfLiteTensor *input = interpreter->input_tensor(0);
+  if (input->type == kTfLiteUInt8) {
+    // Quantized model, write the RGB bytes directly
+    tensor_fill_.fill(pkt.data,
+                      interpreter->typed_input_tensor<uint8_t>(0),
+                      input->params.scale,
+                      input->params.zero_point);
+  } else {
+    tensor_fill_.fill(pkt.data, interpreter->typed_input_tensor<float>(0));
   }
+}
 
+template <typename Planes>
+void program::draw_snowflakes(Planes &planes, uint8_t *frame) {
   // initialize 500 flakes
-  static std::vector<snowflake> flakes;
   if (flakes.empty()) {
     for (int i = 0; i < 500; i++) {
       flakes.push_back(snowflake{});
@@ -732,84 +1661,23 @@ void program::draw_snowflakes(AVPacket &pkt_copy) {
 
   // update snowflake positions and global time
   for (auto &snowflake : flakes) {
-    snowflake.update();
+    snowflake.update(snow_time);
   }
-  tt += 0.0004;
-
-  // draw each snowflake
-  size_t index = 0;
-  float *bg_y = background_y.data();
-  float *bg_u = background_u.data();
-  float *bg_v = background_v.data();
-
-  const auto yuv_to_rgb = [](auto Y, auto U, auto V, auto &R, auto &G, auto &B) {
-    B = 1.164 * (Y - 16) + 2.018 * (U - 128);
-    G = 1.164 * (Y - 16) - 0.813 * (V - 128) - 0.391 * (U - 128);
-    R = 1.164 * (Y - 16) + 1.596 * (V - 128);
-  };
-
-  const auto rgb_to_yuv = [](auto R, auto G, auto B, auto &Y, auto &U, auto &V) {
-    Y = (0.257 * R) + (0.504 * G) + (0.098 * B) + 16;
-    U = -(0.148 * R) - (0.291 * G) + (0.439 * B) + 128;
-    V = (0.439 * R) - (0.368 * G) - (0.071 * B) + 128;
-  };
-
-  for (auto &snowflake : flakes) {
-    auto flake_x = std::clamp(int(snowflake.x - snowflake.radiussize) - 1, 0, 640 - 1);
-    auto flake_y = std::clamp(int(snowflake.y - snowflake.radiussize) - 1, 0, 480 - 1);
-    auto flake_x_end = std::clamp(int(flake_x + (snowflake.radiussize * 2.5) + 2), 0, 640 - 1);
-    auto flake_y_end = std::clamp(int(flake_y + (snowflake.radiussize * 2.5) + 2), 0, 480 - 1);
-
-    for (int y = flake_y; y < flake_y_end; y++) {
-      for (int x = flake_x; x < flake_x_end; x++) {
-        int index_Y = y * src_w + x;
-        int index_U = (src_w * src_h) + (y / 2) * (src_w / 2) + x / 2;
-        int index_V = (int)((src_w * src_h) * 1.25 + (y / 2) * (src_w / 2) + x / 2);
-
-        // pointers to Y U V
-        float *pY = bg_y + (y * src_w) + x, *pU = bg_u + (y * src_w) + x, *pV = bg_v + (y * src_w) + x;
-
-        // convert 0-1 to 0-255
-        double Y = *pY * 255., U = *pU * 255., V = *pV * 255.;
-
-        // convert YUV to RGB
-        double R = 0, G = 0, B = 0;
-        yuv_to_rgb(Y, U, V, R, G, B);
-
-        // calculate pixel value of snowflake
-        auto dist = index % 3 == 0 ? get_distance_approx(double(x), double(y), snowflake.x, snowflake.y)
-                                   : get_distance(double(x), double(y), snowflake.x, snowflake.y);
-        auto color_alpha = 1. - (snowflake.expf(dist / snowflake.radiussize, 1000));
-        color_alpha *= snowflake.opacity;
-
-        // update function to blend the pixel with background
-        const auto update_snowflake_pixel = [&]() {
-          auto bg_a = 1.;
-          const auto a = color_alpha + (bg_a * (1. - color_alpha) / 1.);
-          R = 255. * ((1. * color_alpha + (R / 255.) * bg_a * (1. - color_alpha) / 1.) / a);
-          G = 255. * ((1. * color_alpha + (G / 255.) * bg_a * (1. - color_alpha) / 1.) / a);
-          B = 255. * ((1. * color_alpha + (B / 255.) * bg_a * (1. - color_alpha) / 1.) / a);
-        };
-        // draw the pixel if it was within the snowflake
-        if (dist < snowflake.radiussize) update_snowflake_pixel();
-
-        // convert RGB to YUV
-        rgb_to_yuv(R, G, B, Y, U, V);
-
-        // commit pixel (normalized to 0-1 again)
-        *pY = (Y / 255.), *pU = (U / 255.), *pV = (V / 255.);
-
-        // now process the foreground canvas as RGB (already 0-255 values)
-        yuv_to_rgb(pkt_copy.data[index_Y], pkt_copy.data[index_U], pkt_copy.data[index_V], R, G, B);
-
-        // draw only large snowflakes (> 5.5) on top of the person!
-        if (dist < snowflake.radiussize && snowflake.radiussize > 5.5) update_snowflake_pixel();
-
-        // commit pixel (normalizing not needed)
-        rgb_to_yuv(R, G, B, pkt_copy.data[index_Y], pkt_copy.data[index_U], pkt_copy.data[index_V]);
-      }
-    }
-    index++;
+  snow_time += 0.0004;
+
+  // draw each snowflake (as many as the quality level allows), every third one with the cheaper distance
+  // approximation
+  const size_t count = std::min(flakes.size(), size_t(quality_.snowflakes));
+  for (size_t index = 0; index < count; index++) {
+    const auto &snowflake = flakes[index];
+    draw_snowflake(snowflake,
+                   index % 3 == 0,
+                   planes.y.data(),
+                   planes.u.data(),
+                   planes.v.data(),
+                   frame,
+                   src_w,
+                   src_h);
   }
 }
 
@@ -832,28 +1700,57 @@ int program::load(std::vector<uint8_t> &bg, const std::string &bg_file) {
   return 0;
 };
 
-void program::convertRGBtoAYUV(const std::vector<uint8_t> &input, std::vector<uint8_t> &output) {
-  size_t size = input.size();
-  output.resize(size);
-
-  for (size_t i = 0; i < size; i += 4) {
-    uint8_t r = static_cast<uint8_t>(input[i]);
-    uint8_t g = static_cast<uint8_t>(input[i + 1]);
-    uint8_t b = static_cast<uint8_t>(input[i + 2]);
-    uint8_t a = static_cast<uint8_t>(input[i + 3]);
-
-    uint8_t y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
-    uint8_t u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
-    uint8_t v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
-    uint8_t a2 = a;
+background_assets program::load_background(const std::string &file,
+                                           int w,
+                                           int h,
+                                           float sigma,
+                                           const asset_cache &cache) {
+  background_assets assets;
+  const std::string entry = cache.entry(file, w, h, sigma);
+  if (cache.load(entry, w, h, sigma, assets)) {
+    return assets;
+  }
+  std::vector<uint8_t> image;
+  if (std::filesystem::path(file).extension() == ".ayuv") {
+    if (load(image, file) != 0) {
+      return {};
+    }
+  } else {
+    convertRGBtoAYUV(processImage(file, w, h), image);
+  }
+  if (image.size() != size_t(w) * h * 4) {
+    std::cout << "Warning: " << file << " is not a " << w << "x" << h << " background" << std::endl;
+    return {};
+  }
+  assets.blurred = make_asset(blur_background_image(image.data(), w, h, sigma));
+  assets.image = make_asset(std::move(image));
+  cache.store(entry, w, h, sigma, assets);
+  return assets;
+}
 
-    output[i] = a2;
-    output[i + 1] = y;
-    output[i + 2] = u;
-    output[i + 3] = v;
+std::vector<uint8_t> program::blur_background_image(const uint8_t *image, int w, int h, float sigma) {
+  const size_t pixels = size_t(w) * h;
+  std::vector<float> planes[3], scratch(pixels);
+  for (int c = 0; c < 3; c++) {
+    planes[c].resize(pixels);
+    for (size_t i = 0; i < pixels; i++) planes[c][i] = image[i * 4 + 1 + c] / 255.;
+    float *in = planes[c].data();
+    float *out = scratch.data();
+    fast_gaussian_blur(in, out, w, h, sigma);
+  }
+  std::vector<uint8_t> blurred(pixels * 4);
+  for (size_t i = 0; i < pixels; i++) {
+    blurred[i * 4] = image[i * 4];
+    for (int c = 0; c < 3; c++) blurred[i * 4 + 1 + c] = uint8_t(planes[c][i] * 255.);
   }
+  return blurred;
+}
+
+void program::convertRGBtoAYUV(const std::vector<uint8_t> &input, std::vector<uint8_t> &output) {
+  output.resize(input.size());
+  rgba_to_ayuv(input.data(), output.data(), input.size() / 4);
 }
-std::vector<uint8_t> program::processImage(const std::string &imagePath) {
+std::vector<uint8_t> program::processImage(const std::string &imagePath, int destWidth, int destHeight) {
   av_register_all();
 
   AVFormatContext *formatContext = nullptr;
@@ -926,9 +1823,6 @@ std::vector<uint8_t> program::processImage(const std::string &imagePath) {
     avformat_close_input(&formatContext);
     throw std::runtime_error("Failed to allocate frame for RGBA conversion");
   }
-  int destWidth = 640;
-  int destHeight = 480;
-
   // Create SwsContext for scaling and conversion
   struct SwsContext *swsContext = sws_getContext(codecContext->width,
                                                  codecContext->height,
@@ -971,17 +1865,62 @@ std::vector<uint8_t> program::processImage(const std::string &imagePath) {
   return imageData;
 }
 
-void program::load_spaceship_frames_into_memory(bool force) {
-  if ((animate || force) && anim_bg.empty()) {
-    anim_bg.reserve(750);
-    std::stringstream ss;
-    for (size_t i = 0; i < 750; i++) {
-      ss << "backgrounds/spaceship/" << i << ".ayuv";
-      load(anim_bg[i], ss.str());
-      ss.str("");
-      ss.clear();
+void program::load_spaceship_frames_into_memory(bool force, std::function<void()> on_ready) {
+  if (!config_->latest().animate && !force) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(anim_bg->mut);
+    if (!anim_bg->ready) {
+      if (on_ready) anim_bg->on_ready.push_back(std::move(on_ready));
+      if (anim_bg->loading) return;
+      anim_bg->loading = true;
+      on_ready = nullptr;
     }
-    std::cout << "pre-loaded spaceship background frames into memory." << std::endl;
+  }
+  if (on_ready) {
+    on_ready();
+    return;
+  }
+
+  // Read the frames in chunks on the pool, the last chunk to finish publishes them
+  const size_t num_frames = 750;
+  const size_t num_chunks = 8;
+  auto frames = std::make_shared<std::vector<std::vector<uint8_t>>>(num_frames);
+  auto remaining = std::make_shared<std::atomic<size_t>>(num_chunks);
+  auto failed = std::make_shared<std::atomic<bool>>(false);
+  auto anim = anim_bg;
+  for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+    pool_->submit([=]() {
+      std::stringstream ss;
+      for (size_t i = chunk * num_frames / num_chunks; i < (chunk + 1) * num_frames / num_chunks; i++) {
+        ss << "backgrounds/spaceship/" << i << ".ayuv";
+        try {
+          if (load((*frames)[i], ss.str()) != 0) *failed = true;
+        } catch (const std::exception &) {
+          *failed = true;
+        }
+        ss.str("");
+        ss.clear();
+      }
+      if (--*remaining > 0) {
+        return;
+      }
+      std::vector<std::function<void()>> on_ready;
+      {
+        std::unique_lock<std::mutex> lock(anim->mut);
+        anim->loading = false;
+        on_ready.swap(anim->on_ready);
+        if (*failed) {
+          std::cout << "Warning: could not load all spaceship background frames." << std::endl;
+          return;
+        }
+        anim->frames = std::move(*frames);
+        anim->ready = true;
+      }
+      std::cout << "pre-loaded spaceship background frames into memory." << std::endl;
+      for (auto &f : on_ready) f();
+    });
   }
 }
 
@@ -1018,13 +1957,14 @@ art by: Marcin Glinski          _
  .dMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMMb
  V I R T U A L    B A C K G R O U N D   W E B C A M
 )" << std::endl;  // source: https://www.asciiart.eu/cartoons/other
+  std::cout << "Pixel kernels: " << simd_level() << std::endl;
   program prog(argc, argv);
   global_program = &prog;
 
   signal(SIGINT, [](int a) {
     printf("^C caught\n");
     if (global_program != nullptr) {
-      global_program->stop({});
+      global_program->stop_all();
       std::exit(0);
     }
   });
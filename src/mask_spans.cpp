@@ -0,0 +1,86 @@
+#include "mask_spans.h"
+
+#include "simd.h"
+
+namespace {
+
+template <typename T>
+ALWAYS_INLINE void classify_row(const T *mask, int w, T low, T high, span_kind *kinds) {
+  for (int x = 0; x < w; x++) {
+    kinds[x] = mask[x] <= low ? span_kind::background : (mask[x] >= high ? span_kind::person : span_kind::edge);
+  }
+}
+
+PIXEL_KERNEL void classify(const float *mask, int w, float low, float high, span_kind *kinds) {
+  classify_row(mask, w, low, high, kinds);
+}
+
+PIXEL_KERNEL void classify(const uint16_t *mask, int w, uint16_t low, uint16_t high, span_kind *kinds) {
+  classify_row(mask, w, low, high, kinds);
+}
+
+// Appends the runs of `kinds` to `spans`
+void encode(const span_kind *kinds, int w, std::vector<mask_span> &spans) {
+  int begin = 0;
+  for (int x = 1; x <= w; x++) {
+    if (x == w || kinds[x] != kinds[begin]) {
+      spans.push_back({begin, x, kinds[begin]});
+      begin = x;
+    }
+  }
+}
+
+}  // namespace
+
+void mask_spans::build(const float *mask, int w, int h) {
+  build(mask, w, h, 0.5f / 255.f, 1.f - 0.5f / 255.f);
+}
+
+void mask_spans::build(const uint16_t *mask, int w, int h) {
+  build(mask, w, h, uint16_t(128), uint16_t(65535 - 128));
+}
+
+template <typename T>
+void mask_spans::build(const T *mask, int w, int h, T low, T high) {
+  spans_.clear();
+  chroma_spans_.clear();
+  rows_.resize(h + 1);
+  chroma_rows_.resize(h / 2 + 1);
+  const int chroma_w = w / 2;
+  kinds_.resize(w * 2 + chroma_w);
+  span_kind *chroma_kinds = kinds_.data() + w * 2;
+  bool any_background = false, any_edge = false, any_person = false;
+  for (int y = 0; y < h; y += 2) {
+    span_kind *top = kinds_.data();
+    span_kind *bottom = top + w;
+    classify(mask + y * w, w, low, high, top);
+    rows_[y] = int(spans_.size());
+    encode(top, w, spans_);
+    if (y + 1 < h) {
+      classify(mask + (y + 1) * w, w, low, high, bottom);
+      rows_[y + 1] = int(spans_.size());
+      encode(bottom, w, spans_);
+    }
+
+    // a 2x2 block is only background or person if all four pixels are, otherwise it is blended
+    if (y / 2 < h / 2) {
+      for (int cx = 0; cx < chroma_w; cx++) {
+        const span_kind k = top[cx * 2];
+        const bool same = top[cx * 2 + 1] == k && bottom[cx * 2] == k && bottom[cx * 2 + 1] == k;
+        chroma_kinds[cx] = same ? k : span_kind::edge;
+      }
+      chroma_rows_[y / 2] = int(chroma_spans_.size());
+      encode(chroma_kinds, chroma_w, chroma_spans_);
+    }
+  }
+  rows_[h] = int(spans_.size());
+  chroma_rows_[h / 2] = int(chroma_spans_.size());
+
+  for (const auto &span : spans_) {
+    any_background |= span.kind == span_kind::background;
+    any_edge |= span.kind == span_kind::edge;
+    any_person |= span.kind == span_kind::person;
+  }
+  all_background_ = !any_edge && !any_person;
+  all_person_ = !any_edge && !any_background;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Kind of mask pixels in a run
+enum class span_kind : uint8_t {
+  background,  // mask is (practically) 0
+  edge,        // anything in between, needs blending
+  person,      // mask is (practically) 1
+};
+
+// [begin, end) run of pixels of the same kind in a row
+struct mask_span {
+  int begin;
+  int end;
+  span_kind kind;
+};
+
+// Run-length encoding of a (blurred) segmentation mask into background, edge and person runs per row, so that
+// compositing only has to blend along the edges of the person. Besides the luma rows there is a set of chroma rows
+// for YUV420P, where a 2x2 block is only background or person if all four of its pixels are.
+// Values within half a step of 8-bit precision from 0 or 1 count as exactly 0 or 1.
+class mask_spans {
+private:
+  std::vector<mask_span> spans_;
+  std::vector<int> rows_;  // index of the first span of each row, plus one past the end
+  std::vector<mask_span> chroma_spans_;
+  std::vector<int> chroma_rows_;
+  std::vector<span_kind> kinds_;  // kind of every pixel of a row pair and its chroma row, scratch space
+  bool all_background_ = false;
+  bool all_person_ = false;
+
+public:
+  void build(const float *mask, int w, int h);
+  void build(const uint16_t *mask, int w, int h);  // unorm16 mask (compact precision)
+
+  bool all_background() const {
+    return all_background_;
+  }
+  bool all_person() const {
+    return all_person_;
+  }
+
+  const mask_span *row_begin(int y) const {
+    return spans_.data() + rows_[y];
+  }
+  const mask_span *row_end(int y) const {
+    return spans_.data() + rows_[y + 1];
+  }
+  const mask_span *chroma_row_begin(int cy) const {
+    return chroma_spans_.data() + chroma_rows_[cy];
+  }
+  const mask_span *chroma_row_end(int cy) const {
+    return chroma_spans_.data() + chroma_rows_[cy + 1];
+  }
+
+private:
+  template <typename T>
+  void build(const T *mask, int w, int h, T low, T high);
+};
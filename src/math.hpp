@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+
 inline double squared(const double &num) {
   return num * num;
 }
@@ -9,12 +12,12 @@ inline double squared_dist(const double &num, const double &num2) {
 }
 
 inline double get_distance_approx(double x, double y, double x2, double y2) {
-  static const double sqrtOf2 = sqrt(2);
-  const auto xAbs = abs(x - x2);
-  const auto yAbs = abs(y - y2);
+  static const double sqrtOf2 = std::sqrt(2);
+  const auto xAbs = std::abs(x - x2);
+  const auto yAbs = std::abs(y - y2);
   return (1. + 1. / (4. - 2. * sqrtOf2)) / 2. * std::min((1. / sqrtOf2) * (xAbs + yAbs), std::max(xAbs, yAbs));
 }
 
 inline double get_distance(double x, double y, double x2, double y2) {
-  return sqrt(squared_dist(x, x2) + squared_dist(y, y2));
+  return std::sqrt(squared_dist(x, x2) + squared_dist(y, y2));
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "model_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+
+model_pool::model_pool(int max_interpreters) : max_interpreters_(std::max(1, max_interpreters)) {
+  resolver_ = std::make_unique<tflite::ops::builtin::BuiltinOpResolver>();
+  // Custom op for Google Meet network
+  resolver_->AddCustom("Convolution2DTransposeBias",
+                       mediapipe::tflite_operations::RegisterConvolution2DTransposeBias());
+}
+
+std::unique_ptr<tflite::Interpreter> model_pool::build_interpreter(const tflite::FlatBufferModel &model) {
+  std::unique_ptr<tflite::Interpreter> interpreter;
+  tflite::InterpreterBuilder builder(model, *resolver_);
+  if (builder(&interpreter) != kTfLiteOk || !interpreter) {
+    fprintf(stderr, "Failed to build interpreter\n");
+    return nullptr;
+  }
+  if (interpreter->AllocateTensors() != kTfLiteOk) {
+    fprintf(stderr, "Failed to allocate tensors\n");
+    return nullptr;
+  }
+  return interpreter;
+}
+
+bool model_pool::preload(const std::string &filename) {
+  {
+    std::unique_lock<std::mutex> lock(mut_);
+    auto it = entries_.find(filename);
+    if (it != entries_.end() && it->second.model) return true;
+  }
+
+  // load outside of the lock, so streams that are running inference are not stalled
+  auto model = tflite::FlatBufferModel::BuildFromFile(filename.c_str());
+  if (!model) {
+    fprintf(stderr, "Failed to load model: %s\n", filename.c_str());
+    return false;
+  }
+  auto interpreter = build_interpreter(*model);
+  if (!interpreter) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(mut_);
+  auto &e = entries_[filename];
+  if (!e.model) {
+    e.model = std::move(model);
+    e.created++;
+    e.idle.push_back(std::move(interpreter));
+  }
+  return true;
+}
+
+std::unique_ptr<tflite::Interpreter> model_pool::acquire(const std::string &filename) {
+  std::unique_lock<std::mutex> lock(mut_);
+  auto it = entries_.find(filename);
+  if (it == entries_.end() || !it->second.model) {
+    return nullptr;
+  }
+  auto &e = it->second;
+  while (e.idle.empty()) {
+    if (e.created < max_interpreters_) {
+      // build outside of the lock, other streams can keep using the pool meanwhile
+      e.created++;
+      const tflite::FlatBufferModel &model = *e.model;
+      lock.unlock();
+      auto interpreter = build_interpreter(model);
+      lock.lock();
+      if (!interpreter) e.created--;
+      return interpreter;
+    }
+    cv_.wait(lock);
+  }
+  auto interpreter = std::move(e.idle.back());
+  e.idle.pop_back();
+  return interpreter;
+}
+
+void model_pool::release(const std::string &filename, std::unique_ptr<tflite::Interpreter> interpreter) {
+  if (!interpreter) return;
+  {
+    std::unique_lock<std::mutex> lock(mut_);
+    entries_[filename].idle.push_back(std::move(interpreter));
+  }
+  cv_.notify_all();
+}
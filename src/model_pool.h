@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tensorflow.hpp"
+
+// Shares loaded models between all streams of the process. Every model file is loaded once (the weights are shared),
+// together with a single op resolver. Interpreters only own their tensor arena, and are handed out from a pool: a
+// stream acquires one for the duration of an inference and releases it afterwards. At most `max_interpreters`
+// interpreters are created per model, further streams wait for one to become available.
+//
+// Note that batching inference requests of multiple streams into a single Invoke() is not possible with the
+// segmentation models we use, as their graphs are built for a fixed batch size of one.
+class model_pool {
+private:
+  struct entry {
+    std::unique_ptr<tflite::FlatBufferModel> model;
+    std::vector<std::unique_ptr<tflite::Interpreter>> idle;
+    int created = 0;
+  };
+
+  std::mutex mut_;
+  std::condition_variable cv_;
+  std::unique_ptr<tflite::ops::builtin::BuiltinOpResolver> resolver_;
+  std::map<std::string, entry> entries_;
+  int max_interpreters_;
+
+public:
+  explicit model_pool(int max_interpreters);
+
+  // Loads the model and builds its first interpreter, returns false if that failed.
+  bool preload(const std::string &filename);
+
+  std::unique_ptr<tflite::Interpreter> acquire(const std::string &filename);
+  void release(const std::string &filename, std::unique_ptr<tflite::Interpreter> interpreter);
+
+private:
+  std::unique_ptr<tflite::Interpreter> build_interpreter(const tflite::FlatBufferModel &model);
+};
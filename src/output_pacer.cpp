@@ -0,0 +1,127 @@
+#include "output_pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+output_pacer::~output_pacer() {
+  stop();
+}
+
+void output_pacer::start(AVFormatContext *output, double fps) {
+  stop();
+  output_ = output;
+  fps_ = fps;
+  pending_ = av_packet_alloc();
+  last_ = av_packet_alloc();
+  write_failed_ = false;
+  {
+    std::unique_lock<std::mutex> lock(mut_);
+    stats_ = pacing_stats{};
+    stats_.fps = fps;
+    intervals_m2_ = 0;
+    stop_ = false;
+  }
+  timer_ = std::thread(&output_pacer::run, this);
+  running_ = true;
+}
+
+void output_pacer::stop() {
+  if (!timer_.joinable()) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mut_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  timer_.join();
+  running_ = false;
+  av_packet_free(&pending_);
+  av_packet_free(&last_);
+  output_ = nullptr;
+}
+
+void output_pacer::submit(AVPacket &pkt) {
+  std::unique_lock<std::mutex> lock(mut_);
+  if (pending_->data) {
+    stats_.dropped++;
+    av_packet_unref(pending_);
+  }
+  av_packet_move_ref(pending_, &pkt);
+}
+
+pacing_stats output_pacer::stats() {
+  std::unique_lock<std::mutex> lock(mut_);
+  return stats_;
+}
+
+void output_pacer::run() {
+  const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1. / fps_));
+  const double period_ms = std::chrono::duration<double, std::milli>(period).count();
+  const auto begin = clock::now();
+  auto next = begin;
+  clock::time_point previous;
+  bool written = false;
+
+  std::unique_lock<std::mutex> lock(mut_);
+  while (!cv_.wait_until(lock, next, [&]() {
+    return stop_;
+  })) {
+    bool repeat = false;
+    if (pending_->data) {
+      av_packet_unref(last_);
+      av_packet_move_ref(last_, pending_);
+    } else {
+      repeat = last_->data != nullptr;
+    }
+    if (last_->data) {
+      lock.unlock();
+      // timestamps follow the ticks, the camera timestamps would repeat and skip along with the frames
+      const AVRational time_base = output_->streams[last_->stream_index]->time_base;
+      last_->pts = av_rescale_q(std::chrono::duration_cast<std::chrono::microseconds>(next - begin).count(),
+                                AVRational{1, 1000000},
+                                time_base);
+      last_->dts = last_->pts;
+      last_->duration = av_rescale_q(std::chrono::duration_cast<std::chrono::microseconds>(period).count(),
+                                     AVRational{1, 1000000},
+                                     time_base);
+      const int ret = av_write_frame(output_, last_);
+      const auto now = clock::now();
+      lock.lock();
+
+      if (ret < 0 && !write_failed_) {
+        std::cerr << "Warning: paced output write failed" << std::endl;
+        write_failed_ = true;
+      }
+      stats_.frames++;
+      if (repeat) stats_.repeated++;
+      if (written) {
+        // running mean and variance of the intervals (Welford)
+        const double interval_ms = std::chrono::duration<double, std::milli>(now - previous).count();
+        const double n = double(stats_.frames - 1);
+        const double delta = interval_ms - stats_.mean_interval_ms;
+        stats_.mean_interval_ms += delta / n;
+        intervals_m2_ += delta * (interval_ms - stats_.mean_interval_ms);
+        stats_.jitter_ms = n > 1 ? std::sqrt(intervals_m2_ / (n - 1)) : 0;
+        stats_.max_deviation_ms = std::max(stats_.max_deviation_ms, std::abs(interval_ms - period_ms));
+      }
+      previous = now;
+      written = true;
+    }
+
+    // keep to the schedule, and skip the ticks that already passed rather than writing a burst to catch up
+    next += period;
+    const auto now = clock::now();
+    if (next < now) {
+      const auto missed = (now - next) / period + 1;
+      stats_.missed_ticks += uint64_t(missed);
+      next += period * missed;
+    }
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+struct AVFormatContext;
+struct AVPacket;
+
+// How evenly the pacer wrote frames, since it started
+struct pacing_stats {
+  double fps = 0;
+  uint64_t frames = 0;          // written to the output
+  uint64_t repeated = 0;        // frames written again because no new one was ready
+  uint64_t dropped = 0;         // processed frames replaced by a newer one before their turn
+  uint64_t missed_ticks = 0;    // ticks skipped because the thread woke up too late for them
+  double mean_interval_ms = 0;  // between consecutive writes
+  double jitter_ms = 0;         // standard deviation of the intervals
+  double max_deviation_ms = 0;  // largest difference between an interval and the period
+};
+
+// Writes the output frames at a constant rate from a timer thread, so consumers get evenly spaced frames however long
+// each one took to process. The frame loop hands over its frames as they are done: on every tick the newest one is
+// written, frames that were overtaken by a newer one are dropped, and when no new frame is ready the last one is
+// written again.
+class output_pacer {
+private:
+  using clock = std::chrono::steady_clock;
+
+  std::thread timer_;
+  std::atomic<bool> running_{false};  // read by the console, timer_ belongs to the thread calling start and stop
+  std::mutex mut_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+
+  AVFormatContext *output_ = nullptr;
+  AVPacket *pending_ = nullptr;  // newest processed frame, not written yet
+  AVPacket *last_ = nullptr;     // last frame written, timer thread only
+  double fps_ = 0;
+  bool write_failed_ = false;
+
+  pacing_stats stats_;
+  double intervals_m2_ = 0;  // for the running variance of the intervals
+
+public:
+  output_pacer() = default;
+  output_pacer(const output_pacer &) = delete;
+  output_pacer &operator=(const output_pacer &) = delete;
+  ~output_pacer();
+
+  // Starts writing the submitted frames to `output` at `fps` frames per second. The frame loop must not write to
+  // `output` itself until stop() returns.
+  void start(AVFormatContext *output, double fps);
+  void stop();
+  bool running() const {
+    return running_;
+  }
+  double fps() const {
+    return fps_;
+  }
+
+  // Takes over the frame in `pkt` (leaving it blank), to be written on the next tick
+  void submit(AVPacket &pkt);
+
+  pacing_stats stats();
+
+private:
+  void run();
+};
@@ -0,0 +1,87 @@
+#include "output_sink.h"
+
+#include <cstring>
+#include <iostream>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+}
+
+#include "kernels.h"
+
+output_sink::output_sink(const sink_spec &spec) : spec_(spec) {}
+
+output_sink::~output_sink() {
+  close();
+}
+
+bool output_sink::open() {
+  close();
+  // v4l2 as the output format, it cannot be detected from the device name
+  avformat_alloc_output_context2(&output_, nullptr, "v4l2", spec_.device.c_str());
+  if (!output_) {
+    std::cout << "Warning: cannot create output for " << spec_.device << std::endl;
+    return false;
+  }
+  stream_ = avformat_new_stream(output_, nullptr);
+  stream_->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+  stream_->codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+  stream_->codecpar->format = AV_PIX_FMT_YUV420P;
+  stream_->codecpar->width = spec_.w;
+  stream_->codecpar->height = spec_.h;
+  stream_->time_base = AVRational{1, 1000000};
+
+  int ret = 0;
+  if (!(output_->oformat->flags & AVFMT_NOFILE)) {
+    ret = avio_open(&output_->pb, spec_.device.c_str(), AVIO_FLAG_WRITE);
+  }
+  if (ret >= 0) {
+    ret = avformat_write_header(output_, nullptr);
+    header_written_ = ret >= 0;
+  }
+  if (ret < 0) {
+    std::cout << "Warning: cannot open output " << spec_.device << std::endl;
+    close();
+    return false;
+  }
+  frame_.resize(size_t(spec_.w) * spec_.h * 3 / 2);
+  start_us_ = av_gettime_relative();
+  return true;
+}
+
+void output_sink::close() {
+  if (!output_) {
+    return;
+  }
+  if (header_written_) {
+    av_write_trailer(output_);
+  }
+  if (!(output_->oformat->flags & AVFMT_NOFILE)) {
+    avio_closep(&output_->pb);
+  }
+  avformat_free_context(output_);
+  output_ = nullptr;
+  stream_ = nullptr;
+  header_written_ = false;
+}
+
+bool output_sink::write(const uint8_t *frame, int w, int h) {
+  if (!output_) {
+    return false;
+  }
+  const uint8_t *data = frame;
+  if (w != spec_.w || h != spec_.h) {
+    scale_yuv420p(frame, w, h, frame_.data(), spec_.w, spec_.h);
+    data = frame_.data();
+  }
+  AVPacket pkt;
+  std::memset(&pkt, 0, sizeof(pkt));
+  pkt.data = const_cast<uint8_t *>(data);
+  pkt.size = int(frame_.size());
+  pkt.stream_index = stream_->index;
+  pkt.pts = av_rescale_q(av_gettime_relative() - start_us_, AVRational{1, 1000000}, stream_->time_base);
+  pkt.dts = pkt.pts;
+  return av_write_frame(output_, &pkt) >= 0;
+}
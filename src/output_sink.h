@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct AVFormatContext;
+struct AVStream;
+
+// An additional output device and the resolution it gets the frames in
+struct sink_spec {
+  std::string device;  // v4l2 loopback device, e.g. /dev/video10
+  int w = 0;
+  int h = 0;
+
+  bool operator==(const sink_spec &other) const {
+    return device == other.device && w == other.w && h == other.h;
+  }
+};
+
+// Writes the processed frames to another v4l2 output device, scaled to its own resolution. All sinks of a stream share
+// the one inference and compositing pass, only the scaling (scale_yuv420p) is per sink.
+class output_sink {
+private:
+  sink_spec spec_;
+  AVFormatContext *output_ = nullptr;
+  AVStream *stream_ = nullptr;
+  std::vector<uint8_t> frame_;
+  bool header_written_ = false;
+  int64_t start_us_ = 0;
+
+public:
+  explicit output_sink(const sink_spec &spec);
+  output_sink(const output_sink &) = delete;
+  output_sink &operator=(const output_sink &) = delete;
+  ~output_sink();
+
+  // Opens the device, prints what went wrong and returns false on failure
+  bool open();
+  void close();
+  bool is_open() const {
+    return output_ != nullptr;
+  }
+  const sink_spec &spec() const {
+    return spec_;
+  }
+
+  // Scales a w x h YUV420P frame to the sink resolution and writes it
+  bool write(const uint8_t *frame, int w, int h);
+};
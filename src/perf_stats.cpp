@@ -0,0 +1,65 @@
+#include "perf_stats.h"
+
+#include <cstring>
+#include <fstream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+cache_miss_counter::cache_miss_counter() {
+#if defined(__linux__)
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  fd_ = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+}
+
+cache_miss_counter::~cache_miss_counter() {
+#if defined(__linux__)
+  if (fd_ >= 0) close(fd_);
+#endif
+}
+
+bool cache_miss_counter::valid() const {
+  return fd_ >= 0;
+}
+
+void cache_miss_counter::start() {
+#if defined(__linux__)
+  if (fd_ < 0) return;
+  ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+  ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+uint64_t cache_miss_counter::stop() {
+  uint64_t count = 0;
+#if defined(__linux__)
+  if (fd_ < 0) return 0;
+  ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+  if (read(fd_, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+  return count;
+}
+
+size_t resident_bytes() {
+  // second field of statm is the resident set, in pages
+  std::ifstream statm("/proc/self/statm");
+  size_t total = 0, resident = 0;
+  if (!(statm >> total >> resident)) return 0;
+#if defined(__linux__)
+  return resident * size_t(sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
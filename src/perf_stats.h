@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Counts the hardware cache misses of the calling thread (perf_event_open). Not available when perf events are
+// restricted (kernel.perf_event_paranoid) or unsupported, valid() tells.
+class cache_miss_counter {
+private:
+  int fd_ = -1;
+
+public:
+  cache_miss_counter();
+  cache_miss_counter(const cache_miss_counter &) = delete;
+  cache_miss_counter &operator=(const cache_miss_counter &) = delete;
+  ~cache_miss_counter();
+
+  bool valid() const;
+  void start();
+  uint64_t stop();
+};
+
+// Resident set size of this process in bytes, 0 if unknown
+size_t resident_bytes();
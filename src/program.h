@@ -1,17 +1,44 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include "asset_cache.h"
+#include "blur_normalized.h"
+#include "blur_sat.h"
+#include "frame_planes.h"
+#include "frame_pool.h"
+#include "mask_spans.h"
+#include "model_pool.h"
+#include "output_pacer.h"
+#include "output_sink.h"
 #include "process.hpp"
+#include "quality_governor.h"
+#include "recorder.h"
+#include "roi_tracker.h"
+#include "scene_change.h"
+#include "shm_ring.h"
+#include "snapshot.h"
+#include "snowflake.h"
+#include "tensor_fill.h"
+#include "thread_pool.h"
 #include "tensorflow.hpp"
 
 using namespace TinyProcessLib;
 
 // Implemented in blur_float.cpp
 extern void fast_gaussian_blur(float *&in, float *&out, int w, int h, float sigma);
+// Implemented in blur_compact.cpp
+extern void fast_gaussian_blur(uint8_t *&in, uint8_t *&out, int w, int h, float sigma);
+extern void fast_gaussian_blur(uint16_t *&in, uint16_t *&out, int w, int h, float sigma);
 
 enum segmentation_model {
   google_meet_full = 1,
@@ -19,6 +46,21 @@ enum segmentation_model {
   mlkit,
 };
 
+// Layout of the model output
+enum class mask_layout {
+  logits,       // (background, person) logits per pixel, google meet models
+  probability,  // person probability per pixel, mlkit
+};
+
+// Frames of the animated background, shared between streams
+struct animation_frames {
+  std::mutex mut;
+  std::vector<std::vector<uint8_t>> frames;
+  bool loading = false;
+  std::vector<std::function<void()>> on_ready;  // called once all frames are loaded
+  std::atomic<bool> ready{false};
+};
+
 struct model_meta_info {
   std::string filename;
   int width;
@@ -34,20 +76,66 @@ enum segmentation_mode {
   virtual_background_blurred,
   snowflakes,
   snowflakes_blur,
-  external_background
+  external_background,
+  depth_of_field
+};
+
+// The settings of a stream that the console changes while frames are processed. The console publishes a new config
+// for every change, the frame loop picks up the latest one at the start of every frame and uses it for the whole
+// frame (see snapshot.h). The background is shared by all configs (and streams) that use it, it is never modified.
+// The console never writes state of the frame loop directly: helpers that keep state across frames (the quality
+// governor, the scene change detector) belong to the frame thread, which sets them up from the config it picked up.
+struct stream_config {
+  segmentation_mode mode = segmentation_mode::virtual_background;
+  bool animate = true;
+  bool compact = false;         // working planes in compact precision (see frame_planes.h)
+  bool use_roi = false;         // only feed the part of the frame containing the person to the model
+  bool use_gating = false;      // reuse the previous mask when the frame barely changed
+  float gating_threshold = 1.5f;  // see scene_change_detector
+  int gating_max_stale = 5;
+  bool use_blur_cache = false;  // only blur the tiles of the frame that changed (see tile_blur.h)
+  bool halo_free_blur = false;  // blur the background without the person in it (see blur_normalized.h)
+  bool shm_output = false;      // publish the frames in shared memory (see shm_ring.h)
+  bool shm_masks = false;       // and their masks
+  bool use_governor = false;      // lower the quality to hold governor_fps (see quality_governor.h)
+  double governor_fps = 30.;
+  unsigned governor_generation = 0;  // changed by every set-governor, the frame loop starts the governor over
+  double output_fps = 0;        // write frames at this constant rate (see output_pacer.h), 0: once processed
+  std::vector<sink_spec> sinks;  // additional output devices, at their own resolution
+  segmentation_model model = google_meet_full;  // model in use, published once a switch is applied
+  asset bg;          // AYUV, none until loaded
+  asset bg_blurred;  // bg blurred with sigma_bg_blur, for virtual_background_blurred
+  std::string bg_file;  // file bg was loaded from
 };
 
 class program {
 private:
   std::thread runner_;
-  bool stop_ = false;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> running_{false};
+
+  // Paused: the runner thread is parked, with the devices, ffmpeg and everything loaded kept alive
+  std::atomic<bool> paused_{false};
+  std::mutex pause_mut_;
+  std::condition_variable pause_cv_;
 
   std::unique_ptr<Process> process_;
   std::thread process_runner_;
 
-  std::unique_ptr<tflite::FlatBufferModel> tflite_model;
-  std::unique_ptr<tflite::ops::builtin::BuiltinOpResolver> resolver;
-  std::unique_ptr<tflite::InterpreterBuilder> builder;
+  // Shared between all streams of this process
+  std::shared_ptr<model_pool> model_pool_;
+  std::shared_ptr<thread_pool> pool_;
+  std::shared_ptr<asset_cache> asset_cache_;
+
+  // Startup: ffmpeg readiness, and the model and backgrounds that are loaded on the pool meanwhile
+  std::mutex feed_mut_;
+  std::condition_variable feed_cv_;
+  bool feed_ready_ = false;
+  bool feed_exited_ = false;
+  std::shared_future<void> model_loading_;
+  bool model_loaded_ = false;
+  std::future<background_assets> bg_loading_;
+  std::string bg_loading_file_;  // set before the runner starts, bg_loading_ loads it
 
   // float sigma_bg_blur = 4.;
   // float sigma_bg_blur = 8.;
@@ -57,56 +145,178 @@ private:
   int src_h = 480;
   std::string bg_file = "backgrounds/bg.ayuv";
   std::map<segmentation_model, model_meta_info> models;
-  segmentation_mode mode = segmentation_mode::virtual_background;
+  // Shared with the background loading tasks on the pool, which may finish after the stream is gone
+  std::shared_ptr<snapshot<stream_config>> config_ = std::make_shared<snapshot<stream_config>>();
+  std::shared_ptr<std::atomic<unsigned>> switch_requests_ = std::make_shared<std::atomic<unsigned>>(0);
+  const stream_config *frame_config_ = nullptr;  // config of the frame being processed
   segmentation_model model_selected = segmentation_model::google_meet_full;
   model_meta_info model;
+  // Model switching while running: loaded in the background, swapped in at the next frame
+  std::thread model_loader_;
+  std::mutex model_mut_;
+  std::atomic<bool> model_pending_{false};
+  segmentation_model pending_model_ = segmentation_model::google_meet_full;
   // TODO: make these strings, and configurable.
   std::string camera_device = "/dev/video0";
   std::string in_filename = "/dev/video8";
   std::string out_filename = "/dev/video9";
-  bool animate = true;
 
+  // Only set while an interpreter is acquired from the pool, the result of the last inference is kept in model_output
   std::unique_ptr<tflite::Interpreter> interpreter;
-  std::vector<uint8_t> bg;
-  std::vector<std::vector<uint8_t>> anim_bg;
+  std::vector<float> model_output;
+  std::vector<float> model_mask;  // person probability at model resolution
+  bool inference_failed_ = false;  // the last inference found no interpreter, warned once
+  tensor_fill tensor_fill_;
+
+  // Region of interest: only feed the part of the frame containing the person to the model
+  roi_tracker roi_tracker_;
+  region roi;
+
+  // Scene change gating: reuse the previous mask when the frame barely changed
+  scene_change_detector scene_change_;
+  int frames_since_inference_ = 0;
+
+  // Adaptive quality: lower the quality step by step to hold the target frame rate. Frame thread only, set up from the
+  // config.
+  quality_governor governor_;
+  unsigned governor_generation_ = 0;
+  quality_level quality_;  // settings for the current frame
+  size_t applied_level_ = 0;
+  bool governor_lowered_model_ = false;
+  std::future<void> governor_model_;
+
+  // Blur the background without the person in it (normalized convolution, see blur_normalized.h)
+  normalized_blur normalized_blur_;
 
-  std::vector<float> mask;
-  std::vector<float> mask2;
-  std::vector<float> background_y, background_u, background_v;
+  std::shared_ptr<animation_frames> anim_bg;
+  size_t anim_index = 0;
+  std::vector<uint8_t> placeholder_bg;
 
-  float *mask_pixels = nullptr;
-  float *mask_out = nullptr;
-  float *mask_out_2 = nullptr;
+  std::vector<snowflake> flakes;
+  double snow_time = 0;
 
-  uint8_t *vbg = nullptr;
+  // Working planes of the frame, in float or compact precision
+  float_planes float_planes_;
+  compact_planes compact_planes_;
+  blur_buffers<float> vbg_blur_;
+  mask_spans spans_;
+  summed_area_tables sat_;
+  std::vector<uint16_t> person_distance_;
+
+  // buffers for packets that cannot be processed in place
+  frame_pool frames_;
+
+  // frames for other processes (set-shm)
+  shm_ring_writer shm_out_;
+  // recording of the output frames (record)
+  recorder recorder_;
+  // constant rate output (set-pacing)
+  output_pacer pacer_;
+  // additional outputs, opened and closed by the frame loop as the config lists them (add-sink)
+  std::vector<std::unique_ptr<output_sink>> sinks_;
+
+  const uint8_t *vbg = nullptr;
+  std::vector<uint8_t> vbg_blurred_;  // blurred copy of the background, for virtual_background_blurred
+  std::vector<float> vbg_planes_[3];  // y, u and v of the background while it is blurred
   bool started = false;
 
+  // Additional camera -> loopback streams served by this process (server mode)
+  std::vector<std::unique_ptr<program>> streams_;
+
 public:
   program(int argc, char **argv);
+  program(const program &parent, const std::string &camera, const std::string &input, const std::string &output);
   ~program();
 
   void start_console();
   int run();
-  std::vector<uint8_t> processImage(const std::string &imagePath);
-  void convertRGBtoAYUV(const std::vector<uint8_t> &input, std::vector<uint8_t> &output);
+  static std::vector<uint8_t> processImage(const std::string &imagePath, int destWidth, int destHeight);
+  static void convertRGBtoAYUV(const std::vector<uint8_t> &input, std::vector<uint8_t> &output);
   unsigned list_cams(const std::vector<std::string> &input);
   unsigned set_cam(const std::vector<std::string> &input);
   unsigned set_mode(const std::vector<std::string> &input);
   unsigned set_model(const std::vector<std::string> &input);
+  unsigned set_roi(const std::vector<std::string> &input);
+  unsigned set_gating(const std::vector<std::string> &input);
+  unsigned set_governor(const std::vector<std::string> &input);
+  unsigned set_precision(const std::vector<std::string> &input);
+  unsigned set_blur_cache(const std::vector<std::string> &input);
+  unsigned set_halo_free(const std::vector<std::string> &input);
+  unsigned set_shm(const std::vector<std::string> &input);
+  std::string shm_name() const;
+  unsigned record(const std::vector<std::string> &input);
+  unsigned set_pacing(const std::vector<std::string> &input);
+  unsigned pacing(const std::vector<std::string> &input);
+  unsigned bench(const std::vector<std::string> &input);
   unsigned start(const std::vector<std::string> &input);
   unsigned stop(const std::vector<std::string> &input);
+  unsigned pause(const std::vector<std::string> &input);
   unsigned preview(const std::vector<std::string> &input);
+  unsigned add_stream(const std::vector<std::string> &input);
+  unsigned list_streams(const std::vector<std::string> &input);
+  unsigned remove_stream(const std::vector<std::string> &input);
+  unsigned add_sink(const std::vector<std::string> &input);
+  unsigned list_sinks(const std::vector<std::string> &input);
+  unsigned remove_sink(const std::vector<std::string> &input);
+  void stop_all();
   unsigned set_background(const std::vector<std::string> &input);
+  // Mode and background changes from the console. The returned function applies a change to the config, unless another
+  // one was requested since: backgrounds are loaded on the pool, and the latest request wins however long each takes.
+  std::function<void(const std::function<void(stream_config &)> &)> switch_request();
 
-  int load(std::vector<uint8_t> &bg, const std::string &bg_file);
-  void load_spaceship_frames_into_memory(bool force = false);
+  static int load(std::vector<uint8_t> &bg, const std::string &bg_file);
+  // A background for w x h frames (.ayuv, or an image that is decoded, scaled and converted) and its blurred variant,
+  // from the asset cache when they are there
+  static background_assets load_background(const std::string &file,
+                                           int w,
+                                           int h,
+                                           float sigma,
+                                           const asset_cache &cache);
+  static std::vector<uint8_t> blur_background_image(const uint8_t *image, int w, int h, float sigma);
+  void load_spaceship_frames_into_memory(bool force = false, std::function<void()> on_ready = nullptr);
   void load_tensorflow_model();
-  void reset();
-  void process_frame(AVPacket &pkt_copy);
-  void fill_input_tensor(const AVPacket &pkt_copy);
-  void upscale_segregation_mask(const AVPacket &pkt_copy);
-  void blur_yuv();
-  void set_virtual_background_source();
+  void queue_model(segmentation_model selected);
+  void apply_pending_model();
+  void govern(double frame_ms);
+  bool wait_for_feed();
+  bool model_ready();
+  void use_loaded_assets();
+  void process_frame(AVPacket &pkt);
+  void publish_shared(const AVPacket &pkt);
+  void write_sinks(const AVPacket &pkt);
+  void fill_input_tensor(const AVPacket &pkt);
+
+  // The frame processing is compiled for every mode, model output layout and precision, so the per-frame work only
+  // contains the steps of the current mode. The pipeline is picked once per frame.
+  using pipeline_fn = void (program::*)(uint8_t *frame);
+  pipeline_fn select_pipeline(bool use_compact) const;
+  template <segmentation_mode Mode, mask_layout Layout, bool Compact>
+  void pipeline(uint8_t *frame);
+  template <segmentation_mode Mode, mask_layout Layout, typename Planes>
+  void process_planes(Planes &planes, uint8_t *frame);
+  template <mask_layout Layout, typename Planes>
+  void upscale_segregation_mask(Planes &planes);
+  template <segmentation_mode Mode, typename Planes>
+  void blur_yuv(Planes &planes, const uint8_t *frame);
+  template <typename Planes>
+  void blur_mask(Planes &planes);
+  template <typename Planes>
+  void blur_depth_of_field(Planes &planes);
+  template <typename Planes>
+  void blur_halo_free(Planes &planes);
+  template <typename T>
+  void blur_plane(std::vector<T> &plane, blur_buffers<T> &buffers, float sigma);
+  template <typename T>
+  void blur_bg_plane(std::vector<T> &plane,
+                     blur_buffers<T> &buffers,
+                     float sigma,
+                     const tile_changes *changes = nullptr,
+                     std::vector<T> *blurred = nullptr);
+  // Points vbg at the background of this frame, the pre-blurred one if `blurred` and there is one (returns true then)
+  bool set_virtual_background_source(bool blurred);
   void blur_virtual_background_itself();
-  void draw_snowflakes(AVPacket &pkt_copy);
+  template <typename Planes>
+  void draw_snowflakes(Planes &planes, uint8_t *frame);
+  template <segmentation_mode Mode, typename Planes>
+  void composite_frame(Planes &planes, uint8_t *frame);
 };
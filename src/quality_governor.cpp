@@ -0,0 +1,79 @@
+#include "quality_governor.h"
+
+quality_governor::quality_governor() {
+  // from full quality to fastest, each step gives up a bit more; the cheapest to notice come first
+  quality_level q;
+  ladder_.push_back(q);
+  q.snowflakes = 250;
+  ladder_.push_back(q);
+  q.pyramid_blur = true;
+  ladder_.push_back(q);
+  q.single_mask_blur = true;
+  q.snowflakes = 100;
+  ladder_.push_back(q);
+  q.inference_interval = 2;
+  ladder_.push_back(q);
+  q.lite_model = true;
+  ladder_.push_back(q);
+  q.inference_interval = 3;
+  ladder_.push_back(q);
+}
+
+void quality_governor::reset() {
+  level_ = 0;
+  average_ms_ = 0;
+  primed_ = false;
+  slow_frames_ = 0;
+  fast_frames_ = 0;
+  settle_frames_ = 0;
+}
+
+bool quality_governor::update(double frame_ms) {
+  // exponential moving average, so a single hiccup does not count
+  average_ms_ = primed_ ? average_ms_ + (frame_ms - average_ms_) * 0.1 : frame_ms;
+  primed_ = true;
+
+  if (settle_frames_ > 0) {
+    settle_frames_--;
+    return false;
+  }
+
+  const double budget = budget_ms();
+  slow_frames_ = average_ms_ > budget ? slow_frames_ + 1 : 0;
+  fast_frames_ = average_ms_ < budget * headroom ? fast_frames_ + 1 : 0;
+
+  size_t level = level_;
+  if (slow_frames_ >= down_after && level_ + 1 < ladder_.size()) {
+    level++;
+  } else if (fast_frames_ >= up_after && level_ > 0) {
+    level--;
+  }
+  if (level == level_) {
+    return false;
+  }
+  level_ = level;
+  slow_frames_ = 0;
+  fast_frames_ = 0;
+  settle_frames_ = settle;
+  return true;
+}
+
+const quality_level &quality_governor::settings() const {
+  return ladder_[level_];
+}
+
+size_t quality_governor::level() const {
+  return level_;
+}
+
+size_t quality_governor::levels() const {
+  return ladder_.size();
+}
+
+double quality_governor::average_ms() const {
+  return average_ms_;
+}
+
+double quality_governor::budget_ms() const {
+  return 1000. / target_fps;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// What to spend time on for one quality level, see quality_governor.
+struct quality_level {
+  int inference_interval = 1;     // run the model every Nth frame, reuse the previous mask in between
+  bool lite_model = false;        // use the lite model instead of the full one
+  bool pyramid_blur = false;      // blur backgrounds at half resolution
+  bool single_mask_blur = false;  // blur the upscaled mask once instead of twice (harder edges)
+  int snowflakes = 500;           // number of snowflakes to draw
+};
+
+// Closed loop controller that trades quality for speed to hold a target frame rate. The per-frame processing time is
+// smoothed and compared to the frame budget: when frames are too slow for a while the governor steps down one level
+// on a fixed ladder, when there is plenty of headroom for a longer while it steps back up. The gap between both
+// thresholds, the longer wait before stepping up and the settle time after each step keep it from oscillating.
+class quality_governor {
+private:
+  std::vector<quality_level> ladder_;
+  size_t level_ = 0;
+  double average_ms_ = 0;
+  bool primed_ = false;
+  int slow_frames_ = 0;
+  int fast_frames_ = 0;
+  int settle_frames_ = 0;
+
+public:
+  double target_fps = 30.;
+  double headroom = 0.75;  // step up only when frames take less than this fraction of the budget
+  int down_after = 10;     // consecutive slow frames before stepping down
+  int up_after = 90;       // consecutive fast frames before stepping up
+  int settle = 30;         // frames to ignore after a step, while the averages catch up
+
+  quality_governor();
+
+  void reset();
+  // Feeds the processing time of one frame, returns true when the quality level changed.
+  bool update(double frame_ms);
+
+  const quality_level &settings() const;
+  size_t level() const;
+  size_t levels() const;
+  double average_ms() const;
+  double budget_ms() const;
+};
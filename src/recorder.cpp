@@ -0,0 +1,215 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+}
+
+namespace {
+
+std::string error_string(int error) {
+  char text[AV_ERROR_MAX_STRING_SIZE];
+  av_strerror(error, text, sizeof(text));
+  return text;
+}
+
+}  // namespace
+
+recorder::~recorder() {
+  stop();
+}
+
+bool recorder::start(const std::string &file, int w, int h, const std::string &codec) {
+  stop();
+  if (avformat_alloc_output_context2(&output_, nullptr, nullptr, file.c_str()) < 0 || !output_) {
+    std::cout << "Cannot record to " << file << ": unknown container, use e.g. .mkv or .mp4" << std::endl;
+    return false;
+  }
+
+  // the requested encoder, or the first one that is available and opens
+  std::vector<const AVCodec *> candidates;
+  if (!codec.empty()) {
+    candidates.push_back(avcodec_find_encoder_by_name(codec.c_str()));
+  } else {
+    candidates = {avcodec_find_encoder(AV_CODEC_ID_H264),
+                  avcodec_find_encoder(AV_CODEC_ID_FFV1),
+                  avcodec_find_encoder(AV_CODEC_ID_MJPEG)};
+  }
+  for (const AVCodec *candidate : candidates) {
+    if (!candidate) {
+      continue;
+    }
+    encoder_context_ = avcodec_alloc_context3(candidate);
+    encoder_context_->width = w;
+    encoder_context_->height = h;
+    encoder_context_->pix_fmt = AV_PIX_FMT_YUV420P;
+    // timestamps count frames: containers like AVI fill every gap between timestamps with empty frames
+    encoder_context_->time_base = AVRational{1, fps};
+    encoder_context_->framerate = AVRational{fps, 1};
+    encoder_context_->gop_size = 60;
+    encoder_context_->max_b_frames = 0;
+    // MJPEG only takes limited range YUV420P (the camera frames) as an extension
+    encoder_context_->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+    if (output_->oformat->flags & AVFMT_GLOBALHEADER) {
+      encoder_context_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    AVDictionary *options = nullptr;
+    av_dict_set(&options, "preset", "veryfast", 0);  // x264, other encoders leave it
+    const int ret = avcodec_open2(encoder_context_, candidate, &options);
+    av_dict_free(&options);
+    if (ret >= 0) {
+      codec_ = candidate->name;
+      break;
+    }
+    avcodec_free_context(&encoder_context_);
+  }
+  if (!encoder_context_) {
+    if (codec.empty()) {
+      std::cout << "Cannot record: no H.264, FFV1 or MJPEG encoder available" << std::endl;
+    } else {
+      std::cout << "Cannot record: cannot open encoder " << codec << std::endl;
+    }
+    close();
+    return false;
+  }
+
+  stream_ = avformat_new_stream(output_, nullptr);
+  avcodec_parameters_from_context(stream_->codecpar, encoder_context_);
+  stream_->time_base = encoder_context_->time_base;
+  int ret = 0;
+  if (!(output_->oformat->flags & AVFMT_NOFILE)) {
+    ret = avio_open(&output_->pb, file.c_str(), AVIO_FLAG_WRITE);
+  }
+  if (ret >= 0) {
+    ret = avformat_write_header(output_, nullptr);
+  }
+  if (ret < 0) {
+    std::cout << "Cannot record to " << file << ": " << error_string(ret) << std::endl;
+    close();
+    return false;
+  }
+
+  w_ = w;
+  h_ = h;
+  buffers_ = av_buffer_pool_init(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, w, h, 1), nullptr);
+  recorded_ = 0;
+  dropped_ = 0;
+  {
+    std::unique_lock<std::mutex> lock(mut_);
+    last_pts_ = -1;
+    stop_ = false;
+    recording_ = true;
+  }
+  encoder_ = std::thread(&recorder::encode, this);
+  return true;
+}
+
+void recorder::stop() {
+  {
+    std::unique_lock<std::mutex> lock(mut_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (encoder_.joinable()) {
+    encoder_.join();
+  }
+  recording_ = false;
+  close();
+}
+
+void recorder::push(const uint8_t *frame) {
+  if (!recording_) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mut_);
+  if (stop_ || !recording_) {
+    return;
+  }
+  AVBufferRef *buffer = queue_.size() < max_queued ? av_buffer_pool_get(buffers_) : nullptr;
+  if (!buffer) {
+    dropped_++;
+    return;
+  }
+  AVFrame *copy = av_frame_alloc();
+  copy->buf[0] = buffer;
+  copy->format = AV_PIX_FMT_YUV420P;
+  copy->width = w_;
+  copy->height = h_;
+  av_image_fill_arrays(copy->data, copy->linesize, buffer->data, AV_PIX_FMT_YUV420P, w_, h_, 1);
+  std::memcpy(buffer->data, frame, size_t(w_) * h_ * 3 / 2);
+  // the recording starts with the first frame, every frame gets the frame slot of the time it was pushed (the next one
+  // when two frames fall into the same slot)
+  const int64_t now = av_gettime_relative();
+  if (last_pts_ < 0) start_us_ = now;
+  last_pts_ = std::max(av_rescale_q(now - start_us_, AVRational{1, 1000000}, AVRational{1, fps}), last_pts_ + 1);
+  copy->pts = last_pts_;
+  queue_.push_back(copy);
+  cv_.notify_one();
+}
+
+void recorder::encode() {
+  for (;;) {
+    AVFrame *frame = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mut_);
+      cv_.wait(lock, [&]() {
+        return stop_ || !queue_.empty();
+      });
+      if (queue_.empty()) {
+        break;
+      }
+      frame = queue_.front();
+      queue_.pop_front();
+    }
+    const int ret = avcodec_send_frame(encoder_context_, frame);
+    av_frame_free(&frame);
+    if (ret < 0 || !write_packets()) {
+      std::cout << "Recording failed" << (ret < 0 ? ": " + error_string(ret) : "") << ", stop it with: record stop"
+                << std::endl;
+      std::unique_lock<std::mutex> lock(mut_);
+      recording_ = false;
+      for (AVFrame *queued : queue_) av_frame_free(&queued);
+      queue_.clear();
+      break;
+    }
+    recorded_++;
+  }
+  // the frames still in the encoder
+  avcodec_send_frame(encoder_context_, nullptr);
+  write_packets();
+  av_write_trailer(output_);
+}
+
+bool recorder::write_packets() {
+  AVPacket *packet = av_packet_alloc();
+  int ret = 0;
+  while ((ret = avcodec_receive_packet(encoder_context_, packet)) >= 0) {
+    av_packet_rescale_ts(packet, encoder_context_->time_base, stream_->time_base);
+    packet->stream_index = stream_->index;
+    ret = av_interleaved_write_frame(output_, packet);
+    if (ret < 0) {
+      break;
+    }
+  }
+  av_packet_free(&packet);
+  return ret >= 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+}
+
+void recorder::close() {
+  if (output_ && !(output_->oformat->flags & AVFMT_NOFILE)) {
+    avio_closep(&output_->pb);
+  }
+  avformat_free_context(output_);
+  output_ = nullptr;
+  stream_ = nullptr;
+  avcodec_free_context(&encoder_context_);
+  // buffers still held by frames are freed when they come back
+  av_buffer_pool_uninit(&buffers_);
+}
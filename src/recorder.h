@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct AVBufferPool;
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVFrame;
+struct AVStream;
+
+// Records the output frames to a video file. Frames are copied into pooled buffers and queued for an encoder thread;
+// when the encoder falls behind and the queue is full, frames are left out of the recording instead, so the live output
+// never waits for it.
+class recorder {
+private:
+  std::thread encoder_;
+  std::mutex mut_;
+  std::condition_variable cv_;
+  std::deque<AVFrame *> queue_;
+  bool stop_ = false;
+  std::atomic<bool> recording_{false};
+  std::atomic<uint64_t> recorded_{0};
+  std::atomic<uint64_t> dropped_{0};
+
+  int w_ = 0;
+  int h_ = 0;
+  int64_t start_us_ = 0;
+  int64_t last_pts_ = -1;
+  AVBufferPool *buffers_ = nullptr;
+  AVFormatContext *output_ = nullptr;
+  AVCodecContext *encoder_context_ = nullptr;
+  AVStream *stream_ = nullptr;
+  std::string codec_;
+
+public:
+  // frames waiting for the encoder, at most
+  size_t max_queued = 8;
+  // frame rate of the recording, the time base of its timestamps
+  int fps = 30;
+
+  recorder() = default;
+  recorder(const recorder &) = delete;
+  recorder &operator=(const recorder &) = delete;
+  ~recorder();
+
+  // Starts recording w x h YUV420P frames to `file` (the container follows the extension), with `codec` or the first
+  // available of H.264, FFV1 and MJPEG. Prints what went wrong and returns false on failure.
+  bool start(const std::string &file, int w, int h, const std::string &codec = "");
+  // Encodes the queued frames and closes the file
+  void stop();
+
+  bool recording() const {
+    return recording_;
+  }
+  const std::string &codec() const {
+    return codec_;
+  }
+  uint64_t recorded() const {
+    return recorded_;
+  }
+  uint64_t dropped() const {
+    return dropped_;
+  }
+
+  // Queues a copy of a frame, timestamped now. Never waits for the encoder.
+  void push(const uint8_t *frame);
+
+private:
+  void encode();
+  bool write_packets();
+  void close();
+};
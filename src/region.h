@@ -0,0 +1,19 @@
+#pragma once
+
+// Axis-aligned rectangle in frame pixel coordinates
+struct region {
+  int x = 0;
+  int y = 0;
+  int w = 0;
+  int h = 0;
+
+  bool contains(int px, int py) const {
+    return px >= x && px < x + w && py >= y && py < y + h;
+  }
+  bool operator==(const region &other) const {
+    return x == other.x && y == other.y && w == other.w && h == other.h;
+  }
+  bool operator!=(const region &other) const {
+    return !(*this == other);
+  }
+};
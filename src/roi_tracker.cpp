@@ -0,0 +1,88 @@
+#include "roi_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+
+void roi_tracker::reset(int frame_w, int frame_h) {
+  frame_w_ = frame_w;
+  frame_h_ = frame_h;
+  aspect_ = float(frame_w) / frame_h;
+  full_frame();
+}
+
+void roi_tracker::full_frame() {
+  x0_ = 0;
+  y0_ = 0;
+  x1_ = frame_w_;
+  y1_ = frame_h_;
+}
+
+void roi_tracker::update(const float *mask) {
+  update(mask, threshold);
+}
+
+void roi_tracker::update(const uint16_t *mask) {
+  update(mask, uint16_t(threshold * 65535.f));
+}
+
+template <typename T>
+void roi_tracker::update(const T *mask, T cutoff) {
+  // bounding box of the person, sampling every other pixel is precise enough
+  int min_x = frame_w_, min_y = frame_h_, max_x = -1, max_y = -1;
+  for (int y = 0; y < frame_h_; y += 2) {
+    const T *row = mask + y * frame_w_;
+    for (int x = 0; x < frame_w_; x += 2) {
+      if (row[x] > cutoff) {
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+      }
+    }
+  }
+
+  // nobody in frame, fall back to the full frame so we can pick the person up again
+  if (max_x < 0) {
+    full_frame();
+    return;
+  }
+
+  // pad with margin, enforce minimum size, and match the aspect ratio of the frame
+  float w = (max_x - min_x + 2) * (1.f + 2 * margin);
+  float h = (max_y - min_y + 2) * (1.f + 2 * margin);
+  w = std::max(w, frame_w_ * min_size);
+  h = std::max(h, frame_h_ * min_size);
+  if (w / h < aspect_)
+    w = h * aspect_;
+  else
+    h = w / aspect_;
+  w = std::min(w, float(frame_w_));
+  h = std::min(h, float(frame_h_));
+
+  // center on the person, then shift back inside the frame
+  const float cx = (min_x + max_x + 1) / 2.f;
+  const float cy = (min_y + max_y + 1) / 2.f;
+  const float x0 = std::clamp(cx - w / 2, 0.f, frame_w_ - w);
+  const float y0 = std::clamp(cy - h / 2, 0.f, frame_h_ - h);
+  const float x1 = x0 + w;
+  const float y1 = y0 + h;
+
+  // grow immediately, shrink smoothly
+  const auto smooth = [&](float current, float target, bool grow) {
+    return grow ? target : current + (target - current) * smoothing;
+  };
+  x0_ = smooth(x0_, x0, x0 < x0_);
+  y0_ = smooth(y0_, y0, y0 < y0_);
+  x1_ = smooth(x1_, x1, x1 > x1_);
+  y1_ = smooth(y1_, y1, y1 > y1_);
+}
+
+region roi_tracker::current() const {
+  // YUV420P chroma is subsampled 2x2, keep the region on even coordinates
+  region r;
+  r.x = int(std::floor(x0_)) & ~1;
+  r.y = int(std::floor(y0_)) & ~1;
+  r.w = std::min((int(std::ceil(x1_)) + 1) & ~1, frame_w_) - r.x;
+  r.h = std::min((int(std::ceil(y1_)) + 1) & ~1, frame_h_) - r.y;
+  return r;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include "region.h"
+
+// Tracks the bounding box of the person in the segmentation mask, so that inference can be limited to the part of the
+// frame that matters. The box is padded with a margin, kept at the aspect ratio of the frame (so the model sees the
+// same proportions as in full frame mode) and smoothed over time. Growing is immediate (so a moving person is never cut
+// off), shrinking happens gradually.
+class roi_tracker {
+private:
+  int frame_w_ = 0;
+  int frame_h_ = 0;
+  float aspect_ = 1.f;  // width / height of the frame
+
+  // smoothed box, in floats to allow sub-pixel smoothing
+  float x0_ = 0, y0_ = 0, x1_ = 0, y1_ = 0;
+
+public:
+  float threshold = 0.5f;   // mask value that counts as person
+  float margin = 0.15f;     // padding, relative to the size of the bounding box
+  float smoothing = 0.2f;   // how fast the box shrinks towards its new size (0..1)
+  float min_size = 0.25f;   // minimum box size, relative to the frame
+
+  void reset(int frame_w, int frame_h);
+  void update(const float *mask);
+  void update(const uint16_t *mask);  // unorm16 mask (compact precision)
+  region current() const;
+
+private:
+  void full_frame();
+  template <typename T>
+  void update(const T *mask, T cutoff);
+};
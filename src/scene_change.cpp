@@ -0,0 +1,51 @@
+#include "scene_change.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+void scene_change_detector::reset(int frame_w, int frame_h) {
+  frame_w_ = frame_w;
+  frame_h_ = frame_h;
+  stale_ = 0;
+  valid_ = false;
+  reference_.resize(thumb_w * thumb_h);
+  current_.resize(thumb_w * thumb_h);
+  row_sums_.resize(frame_w);
+}
+
+void scene_change_detector::make_thumbnail(const uint8_t *luma, std::vector<uint16_t> &thumb) {
+  // average each block of the frame into one thumbnail pixel (kept as 8.8 fixed-point for precision)
+  for (int ty = 0; ty < thumb_h; ty++) {
+    const int y0 = ty * frame_h_ / thumb_h, y1 = (ty + 1) * frame_h_ / thumb_h;
+    std::fill(row_sums_.begin(), row_sums_.end(), 0);
+    for (int y = y0; y < y1; y++) {
+      const uint8_t *row = luma + y * frame_w_;
+      for (int x = 0; x < frame_w_; x++) row_sums_[x] += row[x];
+    }
+    for (int tx = 0; tx < thumb_w; tx++) {
+      const int x0 = tx * frame_w_ / thumb_w, x1 = (tx + 1) * frame_w_ / thumb_w;
+      uint32_t sum = 0;
+      for (int x = x0; x < x1; x++) sum += row_sums_[x];
+      thumb[ty * thumb_w + tx] = uint16_t((sum << 8) / std::max(1, (x1 - x0) * (y1 - y0)));
+    }
+  }
+}
+
+bool scene_change_detector::needs_inference(const uint8_t *luma) {
+  make_thumbnail(luma, current_);
+
+  if (valid_ && stale_ < max_stale) {
+    uint32_t sad = 0;
+    for (int i = 0; i < thumb_w * thumb_h; i++) sad += std::abs(int(current_[i]) - int(reference_[i]));
+    const float mean_diff = sad / (256.f * thumb_w * thumb_h);
+    if (mean_diff < threshold) {
+      stale_++;
+      return false;
+    }
+  }
+
+  std::swap(reference_, current_);
+  stale_ = 0;
+  valid_ = true;
+  return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Cheap frame difference detector, decides whether a frame differs enough from the last inferred frame to be worth
+// running the model on. Frames are compared as a small luma thumbnail using the mean absolute difference (SAD), and
+// a frame is never considered unchanged more than `max_stale` times in a row.
+class scene_change_detector {
+private:
+  static constexpr int thumb_w = 64;
+  static constexpr int thumb_h = 48;
+
+  int frame_w_ = 0;
+  int frame_h_ = 0;
+  int stale_ = 0;
+  bool valid_ = false;
+
+  std::vector<uint16_t> reference_;  // thumbnail of the last inferred frame
+  std::vector<uint16_t> current_;
+  std::vector<uint32_t> row_sums_;
+
+public:
+  float threshold = 1.5f;  // mean absolute luma difference per thumbnail pixel
+  int max_stale = 5;       // maximum number of consecutive frames that may reuse the previous mask
+
+  void reset(int frame_w, int frame_h);
+  bool needs_inference(const uint8_t *luma);
+
+private:
+  void make_thumbnail(const uint8_t *luma, std::vector<uint16_t> &thumb);
+};
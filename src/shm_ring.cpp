@@ -0,0 +1,250 @@
+#include "shm_ring.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <new>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace shm_ring_layout;
+
+static_assert(sizeof(header) <= header_bytes, "ring header does not fit");
+static_assert(sizeof(slot) <= slot_header_bytes, "slot header does not fit");
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "atomics in shared memory must be lock free");
+
+namespace {
+
+// Futexes shared between processes, so not FUTEX_PRIVATE_FLAG
+void futex_wake(std::atomic<uint32_t> &word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void futex_wait(const std::atomic<uint32_t> &word, uint32_t value, int timeout_ms) {
+  timespec timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  syscall(SYS_futex, reinterpret_cast<const uint32_t *>(&word), FUTEX_WAIT, value, &timeout, nullptr, 0);
+}
+
+size_t align(size_t size) {
+  return (size + 63) & ~size_t(63);
+}
+
+uint8_t mask_byte(float v) {
+  return uint8_t(std::clamp(v * 255.f + 0.5f, 0.f, 255.f));
+}
+uint8_t mask_byte(uint16_t v) {
+  return uint8_t(v >> 8);
+}
+
+}  // namespace
+
+uint64_t monotonic_ns() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint64_t(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+shm_ring_writer::~shm_ring_writer() {
+  close();
+}
+
+bool shm_ring_writer::open(const std::string &name, int w, int h, bool with_mask, int slots) {
+  close();
+  const uint64_t frame_bytes = uint64_t(w) * h * 3 / 2;
+  const uint64_t mask_bytes = with_mask ? uint64_t(w) * h : 0;
+  const uint64_t slot_bytes = align(slot_header_bytes + frame_bytes + mask_bytes);
+  const size_t size = header_bytes + slot_bytes * slots;
+
+  // readers of an older ring keep their mapping of it, and see it closed
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    std::cout << "Warning: cannot create shared memory " << name << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (ftruncate(fd, off_t(size)) != 0) {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    return false;
+  }
+  data_ = static_cast<uint8_t *>(data);
+  size_ = size;
+  name_ = name;
+  frame_ = 0;
+  with_mask_ = with_mask;
+
+  // the memory is zeroed, the header is complete once the magic is there
+  auto *head = new (data_) header{};
+  head->version = version;
+  head->width = uint32_t(w);
+  head->height = uint32_t(h);
+  head->format = format_yuv420p;
+  head->slots = uint32_t(slots);
+  head->frame_bytes = frame_bytes;
+  head->mask_bytes = mask_bytes;
+  head->slot_bytes = slot_bytes;
+  for (int i = 0; i < slots; i++) new (data_ + header_bytes + slot_bytes * i) slot{};
+  head->magic.store(magic, std::memory_order_release);
+  return true;
+}
+
+void shm_ring_writer::close() {
+  if (!data_) {
+    return;
+  }
+  auto *head = reinterpret_cast<header *>(data_);
+  head->closed.store(1, std::memory_order_release);
+  head->notify.fetch_add(1, std::memory_order_release);
+  futex_wake(head->notify);
+  munmap(data_, size_);
+  shm_unlink(name_.c_str());
+  data_ = nullptr;
+  size_ = 0;
+}
+
+template <typename Mask>
+void shm_ring_writer::publish_frame(const uint8_t *frame, int64_t pts, const Mask *mask) {
+  if (!data_) {
+    return;
+  }
+  auto *head = reinterpret_cast<header *>(data_);
+  const uint64_t number = ++frame_;
+  uint8_t *base = data_ + header_bytes + head->slot_bytes * ((number - 1) % head->slots);
+  auto *s = reinterpret_cast<slot *>(base);
+
+  s->sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s->pts = pts;
+  s->time_ns = monotonic_ns();
+  uint8_t *pixels = base + slot_header_bytes;
+  std::memcpy(pixels, frame, head->frame_bytes);
+  s->has_mask = mask && head->mask_bytes;
+  if (s->has_mask) {
+    uint8_t *alpha = pixels + head->frame_bytes;
+    for (uint64_t i = 0; i < head->mask_bytes; i++) alpha[i] = mask_byte(mask[i]);
+  }
+  s->sequence.store(number, std::memory_order_release);
+
+  head->latest.store(number, std::memory_order_release);
+  head->notify.fetch_add(1, std::memory_order_release);
+  futex_wake(head->notify);
+}
+
+void shm_ring_writer::publish(const uint8_t *frame, int64_t pts, const float *mask) {
+  publish_frame(frame, pts, mask);
+}
+
+void shm_ring_writer::publish(const uint8_t *frame, int64_t pts, const uint16_t *mask) {
+  publish_frame(frame, pts, mask);
+}
+
+shm_ring_reader::~shm_ring_reader() {
+  close();
+}
+
+bool shm_ring_reader::open(const std::string &name) {
+  close();
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < header_bytes) {
+    ::close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<uint8_t *>(data);
+  size_ = size_t(st.st_size);
+  const shm_ring_layout::header &h = head();
+  if (h.magic.load(std::memory_order_acquire) != magic || h.version != version ||
+      h.format != format_yuv420p || header_bytes + h.slot_bytes * h.slots > size_) {
+    close();
+    return false;
+  }
+  last_ = h.latest.load(std::memory_order_acquire);
+  return true;
+}
+
+void shm_ring_reader::close() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+int shm_ring_reader::width() const {
+  return data_ ? int(head().width) : 0;
+}
+
+int shm_ring_reader::height() const {
+  return data_ ? int(head().height) : 0;
+}
+
+bool shm_ring_reader::has_masks() const {
+  return data_ && head().mask_bytes > 0;
+}
+
+bool shm_ring_reader::closed() const {
+  return !data_ || head().closed.load(std::memory_order_acquire);
+}
+
+const shm_ring_layout::slot &shm_ring_reader::slot(uint64_t sequence) const {
+  const shm_ring_layout::header &h = head();
+  return *reinterpret_cast<const shm_ring_layout::slot *>(data_ + header_bytes +
+                                                           h.slot_bytes * ((sequence - 1) % h.slots));
+}
+
+bool shm_ring_reader::next(shm_frame &frame, int timeout_ms) {
+  if (!data_) {
+    return false;
+  }
+  const shm_ring_layout::header &h = head();
+  const uint32_t notified = h.notify.load(std::memory_order_acquire);
+  uint64_t latest = h.latest.load(std::memory_order_acquire);
+  if (latest == last_) {
+    if (h.closed.load(std::memory_order_acquire)) {
+      return false;
+    }
+    futex_wait(h.notify, notified, timeout_ms);
+    latest = h.latest.load(std::memory_order_acquire);
+    if (latest == last_) {
+      return false;
+    }
+  }
+  const shm_ring_layout::slot &s = slot(latest);
+  if (s.sequence.load(std::memory_order_acquire) != latest) {
+    return false;  // overwritten already
+  }
+  frame.sequence = latest;
+  frame.pts = s.pts;
+  frame.time_ns = s.time_ns;
+  frame.yuv = reinterpret_cast<const uint8_t *>(&s) + slot_header_bytes;
+  frame.mask = s.has_mask ? frame.yuv + h.frame_bytes : nullptr;
+  last_ = latest;
+  return intact(frame);
+}
+
+bool shm_ring_reader::intact(const shm_frame &frame) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return data_ && slot(frame.sequence).sequence.load(std::memory_order_relaxed) == frame.sequence;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Frame output for other processes on this machine, through a ring of frames in POSIX shared memory (shm_open).
+// Readers map the ring and read the frames in place: no v4l2 device to open, nothing to decode, and a new frame wakes
+// them up right away (futex on the ring header).
+//
+// Every slot has a sequence number, 0 while it is written and the frame number once it is complete. Readers check the
+// number before and after reading a slot: if it changed, the writer overwrote the frame meanwhile (the reader is more
+// than `slots` frames behind).
+
+namespace shm_ring_layout {
+
+constexpr uint32_t magic = 0x56424652;  // "VBFR"
+constexpr uint32_t version = 1;
+constexpr uint32_t format_yuv420p = 1;
+
+struct header {
+  std::atomic<uint32_t> magic;  // set once the header is complete
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t slots;
+  uint64_t frame_bytes;  // YUV420P
+  uint64_t mask_bytes;   // 8-bit alpha mask (0 = background, 255 = person), 0 without masks
+  uint64_t slot_bytes;   // slot header, frame and mask, cache line aligned
+  std::atomic<uint64_t> latest;   // number of the last complete frame, 0 before the first one
+  std::atomic<uint32_t> notify;   // futex word, changes with every frame
+  std::atomic<uint32_t> closed;   // set when the writer is gone, readers should open the ring again
+};
+
+struct slot {
+  std::atomic<uint64_t> sequence;  // frame number, 0 while written
+  int64_t pts;                     // of the camera packet
+  uint64_t time_ns;                // CLOCK_MONOTONIC when published
+  uint32_t has_mask;
+};
+
+constexpr size_t header_bytes = 128;
+constexpr size_t slot_header_bytes = 64;
+
+}  // namespace shm_ring_layout
+
+// Writer side, in the frame loop
+class shm_ring_writer {
+private:
+  std::string name_;
+  uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t frame_ = 0;
+  bool with_mask_ = false;
+
+public:
+  ~shm_ring_writer();
+
+  // Creates the ring `name` (e.g. "/webcamvb-video9") for w x h YUV420P frames, replacing an older one
+  bool open(const std::string &name, int w, int h, bool with_mask, int slots = 4);
+  void close();
+  bool is_open() const {
+    return data_ != nullptr;
+  }
+  const std::string &name() const {
+    return name_;
+  }
+  bool has_masks() const {
+    return with_mask_;
+  }
+
+  // Publishes a frame, with the mask at frame resolution if the ring has masks (nullptr: no mask for this frame)
+  void publish(const uint8_t *frame, int64_t pts, const float *mask);
+  void publish(const uint8_t *frame, int64_t pts, const uint16_t *mask);
+
+private:
+  template <typename Mask>
+  void publish_frame(const uint8_t *frame, int64_t pts, const Mask *mask);
+};
+
+// A frame in the ring, valid while shm_ring_reader::intact says so
+struct shm_frame {
+  uint64_t sequence = 0;
+  int64_t pts = 0;
+  uint64_t time_ns = 0;
+  const uint8_t *yuv = nullptr;   // YUV420P
+  const uint8_t *mask = nullptr;  // nullptr without a mask
+};
+
+// Reader side, for other processes
+class shm_ring_reader {
+private:
+  uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t last_ = 0;
+
+public:
+  ~shm_ring_reader();
+
+  bool open(const std::string &name);
+  void close();
+
+  int width() const;
+  int height() const;
+  bool has_masks() const;
+  // the writer closed the ring, open it again to follow a new one
+  bool closed() const;
+
+  // Waits up to `timeout_ms` for a frame after the last one returned, and returns the newest one. Frames in between
+  // are skipped (`sequence` shows how many).
+  bool next(shm_frame &frame, int timeout_ms);
+
+  // Whether the frame was not overwritten (yet), check after reading it
+  bool intact(const shm_frame &frame) const;
+
+private:
+  const shm_ring_layout::header &head() const {
+    return *reinterpret_cast<const shm_ring_layout::header *>(data_);
+  }
+  const shm_ring_layout::slot &slot(uint64_t sequence) const;
+};
+
+// CLOCK_MONOTONIC in nanoseconds, the clock of shm_frame::time_ns
+uint64_t monotonic_ns();
@@ -0,0 +1,16 @@
+#include "simd.h"
+
+const char *simd_level() {
+#if defined(__x86_64__)
+  // same order of preference as the target_clones resolver
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return "avx512f";
+  if (__builtin_cpu_supports("avx2")) return "avx2";
+  if (__builtin_cpu_supports("sse4.1")) return "sse4.1";
+  return "sse2";
+#elif defined(__ARM_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// Pixel kernels are compiled once per instruction set (SSE2, SSE4.1, AVX2, AVX-512) and the best version for the CPU
+// is selected when the program is loaded (GCC/Clang function multi-versioning, dispatched via cpuid). This keeps a
+// single release binary that runs everywhere, at full speed on modern machines. ARM builds use NEON, which is always
+// available on aarch64.
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define PIXEL_KERNEL __attribute__((target_clones("default", "sse4.1", "avx2", "avx512f")))
+#endif
+#endif
+
+#ifndef PIXEL_KERNEL
+#define PIXEL_KERNEL
+#endif
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Name of the instruction set the pixel kernels run with on this machine
+const char *simd_level();
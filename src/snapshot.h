@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A value that is changed by one side (the console) and read once per frame by another (the frame loop), without the
+// reader ever taking a lock or seeing a half made change.
+// Published values are immutable: a change copies the latest value, changes the copy and swaps the pointer to it in.
+// The reader announces the value it is using (a hazard pointer), writers only free the values that were swapped out
+// and are not in use. There is a single reader, which keeps its value until it reads again.
+template <typename T>
+class snapshot {
+private:
+  std::atomic<T *> latest_;
+  std::atomic<T *> reading_{nullptr};
+  mutable std::mutex write_mut_;  // writers only
+  std::vector<std::unique_ptr<T>> retired_;
+
+public:
+  snapshot() : snapshot(T{}) {}
+  explicit snapshot(T initial) : latest_(new T(std::move(initial))) {}
+  ~snapshot() {
+    delete latest_.load();
+  }
+  snapshot(const snapshot &) = delete;
+  snapshot &operator=(const snapshot &) = delete;
+
+  // Reader: the latest value, valid until the next call
+  const T &read() {
+    T *value = latest_.load();
+    reading_.store(value);
+    // a writer may have swapped and freed it before it was announced, then take the new one
+    for (T *next; (next = latest_.load()) != value;) {
+      value = next;
+      reading_.store(value);
+    }
+    return *value;
+  }
+
+  // Writers: a copy of the latest value
+  T latest() const {
+    std::lock_guard<std::mutex> lock(write_mut_);
+    return *latest_.load();
+  }
+
+  // Writers: publishes a copy of the latest value after `change(T &)`
+  template <typename F>
+  void update(F change) {
+    std::lock_guard<std::mutex> lock(write_mut_);
+    auto next = std::make_unique<T>(*latest_.load());
+    change(*next);
+    retired_.emplace_back(latest_.exchange(next.release()));
+    const T *in_use = reading_.load();
+    retired_.erase(std::remove_if(retired_.begin(),
+                                  retired_.end(),
+                                  [&](const std::unique_ptr<T> &value) {
+                                    return value.get() != in_use;
+                                  }),
+                   retired_.end());
+  }
+};
@@ -2,8 +2,12 @@
 
 #include <random>
 
-double tt = 0;
-std::mt19937 mt;
+namespace {
+
+// every stream creates and moves its snowflakes on its own thread
+thread_local std::mt19937 mt;
+
+}  // namespace
 
 snowflake::snowflake() {
   x = rand() * 640;
@@ -15,10 +19,10 @@ snowflake::snowflake() {
   opacity = rand();
 }
 
-void snowflake::update() {
+void snowflake::update(double time) {
   double e = 0.04;
   y += 0.5 + (e * 200 * (size));
-  x = static_x + (sin(tt * 10) * 200);
+  x = static_x + (sin(time * 10) * 200);
   while (y >= 480) {
     y -= 480;
   }
@@ -30,7 +34,7 @@ void snowflake::update() {
   }
 }
 
-double snowflake::expf(double v, double factor) {
+double snowflake::expf(double v, double factor) const {
   auto max = factor;
   auto maxexp = log(max + 1.0) / log(2.0);
   auto linear = v;
@@ -12,8 +12,8 @@ public:
   double radiussize = 0;
 
   snowflake();
-  void update();
-  double expf(double v, double factor);
+  void update(double time);
+  double expf(double v, double factor) const;
 
 private:
   double rand();
@@ -0,0 +1,189 @@
+#include "tensor_fill.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "colour.hpp"
+#include "simd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+inline uint8_t clamp_u8(int v) {
+  return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Sums rows [begin, end) of a plane column-wise into `sums` for columns [x_begin, x_end), the compiler vectorizes the
+// inner loop.
+PIXEL_KERNEL void sum_columns(const uint8_t *plane,
+                              int stride,
+                              int begin,
+                              int end,
+                              int x_begin,
+                              int x_end,
+                              uint32_t *sums) {
+  std::fill(sums + x_begin, sums + x_end, 0);
+  for (int row = begin; row < end; row++) {
+    const uint8_t *line = plane + row * stride;
+    for (int x = x_begin; x < x_end; x++) sums[x] += line[x];
+  }
+}
+
+// Writes `n` bytes as normalized [0, 1] floats.
+PIXEL_KERNEL void bytes_to_normalized(const uint8_t *in, float *out, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(1.f / 255.f);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+    _mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+    _mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+  }
+#elif defined(__ARM_NEON)
+  const float32x4_t scale = vdupq_n_f32(1.f / 255.f);
+  for (; i + 16 <= n; i += 16) {
+    const uint8x16_t bytes = vld1q_u8(in + i);
+    const uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+    const uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+    vst1q_f32(out + i, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale));
+    vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), scale));
+    vst1q_f32(out + i + 8, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale));
+    vst1q_f32(out + i + 12, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), scale));
+  }
+#endif
+  for (; i < n; i++) out[i] = in[i] * (1.f / 255.f);
+}
+
+}  // namespace
+
+void tensor_fill::configure(int src_w, int src_h, const region &roi, int dst_w, int dst_h) {
+  if (src_w == src_w_ && src_h == src_h_ && roi == roi_ && dst_w == dst_w_ && dst_h == dst_h_) {
+    return;
+  }
+  src_w_ = src_w;
+  src_h_ = src_h;
+  roi_ = roi;
+  dst_w_ = dst_w;
+  dst_h_ = dst_h;
+
+  // spans are relative to the frame, covering only [offset, offset + size) of it
+  const auto make_spans = [](int src,
+                             int offset,
+                             int size,
+                             int dst,
+                             std::vector<span> &luma,
+                             std::vector<span> &chroma) {
+    luma.resize(dst);
+    chroma.resize(dst);
+    for (int i = 0; i < dst; i++) {
+      const int begin = std::min(offset + i * size / dst, src - 1);
+      const int end = std::min(std::max(begin + 1, offset + (i + 1) * size / dst), src);
+      luma[i] = {begin, end};
+      const int cbegin = std::min(begin / 2, src / 2 - 1);
+      chroma[i] = {cbegin, std::max(cbegin + 1, std::min((end + 1) / 2, src / 2))};
+    }
+  };
+  make_spans(src_w, roi.x, roi.w, dst_w, x_spans_, cx_spans_);
+  make_spans(src_h, roi.y, roi.h, dst_h, y_spans_, cy_spans_);
+
+  const auto area = [](const std::vector<span> &xs, const std::vector<span> &ys) {
+    int max_w = 0, max_h = 0;
+    for (const auto &s : xs) max_w = std::max(max_w, s.end - s.begin);
+    for (const auto &s : ys) max_h = std::max(max_h, s.end - s.begin);
+    return max_w * max_h;
+  };
+  const int max_area = std::max(area(x_spans_, y_spans_), area(cx_spans_, cy_spans_));
+  recip_.resize(max_area + 1);
+  recip_[0] = 0;
+  for (int n = 1; n <= max_area; n++) recip_[n] = ((1u << 16) + n / 2) / n;
+
+  col_y_.resize(src_w);
+  col_u_.resize(src_w / 2);
+  col_v_.resize(src_w / 2);
+  rgb_.resize(dst_w * 3);
+}
+
+void tensor_fill::convert_row(const uint8_t *yuv420p, int y) {
+  const int chroma_w = src_w_ / 2;
+  const uint8_t *plane_y = yuv420p;
+  const uint8_t *plane_u = plane_y + src_w_ * src_h_;
+  const uint8_t *plane_v = plane_u + chroma_w * (src_h_ / 2);
+
+  const span &ys = y_spans_[y];
+  const span &cys = cy_spans_[y];
+  const int x_begin = x_spans_.front().begin, x_end = x_spans_.back().end;
+  const int cx_begin = cx_spans_.front().begin, cx_end = cx_spans_.back().end;
+  sum_columns(plane_y, src_w_, ys.begin, ys.end, x_begin, x_end, col_y_.data());
+  sum_columns(plane_u, chroma_w, cys.begin, cys.end, cx_begin, cx_end, col_u_.data());
+  sum_columns(plane_v, chroma_w, cys.begin, cys.end, cx_begin, cx_end, col_v_.data());
+
+  const int rows = ys.end - ys.begin;
+  const int chroma_rows = cys.end - cys.begin;
+
+  // Per tensor pixel, the spans are of varying width and the colour conversion looks up tables, so this loop stays
+  // scalar: the vectorized work is the column sums above and the normalization of the finished rows (fill)
+  uint8_t *rgb = rgb_.data();
+  for (int x = 0; x < dst_w_; x++) {
+    const span &xs = x_spans_[x];
+    const span &cxs = cx_spans_[x];
+
+    uint32_t sum_y = 0, sum_u = 0, sum_v = 0;
+    for (int i = xs.begin; i < xs.end; i++) sum_y += col_y_[i];
+    for (int i = cxs.begin; i < cxs.end; i++) {
+      sum_u += col_u_[i];
+      sum_v += col_v_[i];
+    }
+
+    const uint32_t inv = recip_[rows * (xs.end - xs.begin)];
+    const uint32_t chroma_inv = recip_[chroma_rows * (cxs.end - cxs.begin)];
+    const uint8_t Y = (sum_y * inv + 0x8000) >> 16;
+    const uint8_t U = (sum_u * chroma_inv + 0x8000) >> 16;
+    const uint8_t V = (sum_v * chroma_inv + 0x8000) >> 16;
+    camera_colour::to_rgb(Y, U, V, rgb[0], rgb[1], rgb[2]);
+    rgb += 3;
+  }
+}
+
+void tensor_fill::fill(const uint8_t *yuv420p, float *out) {
+  const int row_size = dst_w_ * 3;
+  for (int y = 0; y < dst_h_; y++) {
+    convert_row(yuv420p, y);
+    bytes_to_normalized(rgb_.data(), out + y * row_size, row_size);
+  }
+}
+
+void tensor_fill::fill(const uint8_t *yuv420p, uint8_t *out, float scale, int zero_point) {
+  // Quantized models expect q = value / scale + zero_point, for the usual scale of 1/255 this is the identity.
+  if (scale != quant_scale_ || zero_point != quant_zero_point_) {
+    quant_scale_ = scale;
+    quant_zero_point_ = zero_point;
+    for (int v = 0; v < 256; v++) {
+      const int q = scale > 0 ? int(std::lround(v / (255.f * scale))) + zero_point : v;
+      quant_lut_[v] = clamp_u8(q);
+    }
+    quant_identity_ = true;
+    for (int v = 0; v < 256 && quant_identity_; v++) quant_identity_ = quant_lut_[v] == v;
+  }
+
+  const int row_size = dst_w_ * 3;
+  for (int y = 0; y < dst_h_; y++) {
+    convert_row(yuv420p, y);
+    uint8_t *dst = out + y * row_size;
+    if (quant_identity_) {
+      std::memcpy(dst, rgb_.data(), row_size);
+    } else {
+      for (int i = 0; i < row_size; i++) dst[i] = quant_lut_[rgb_[i]];
+    }
+  }
+}
@@ -0,0 +1,33 @@
+#include "thread_pool.h"
+
+thread_pool::thread_pool(size_t num_threads) {
+  for (size_t i = 0; i < num_threads; i++) {
+    workers_.emplace_back(&thread_pool::worker, this);
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::unique_lock<std::mutex> lock(mut_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) worker.join();
+}
+
+void thread_pool::worker() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mut_);
+      cv_.wait(lock, [&]() {
+        return stop_ || !tasks_.empty();
+      });
+      // finish all queued work before stopping
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
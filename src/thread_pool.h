@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Small fixed-size thread pool for background work (model loading, background assets, ..)
+class thread_pool {
+private:
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mut_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+
+public:
+  explicit thread_pool(size_t num_threads);
+  ~thread_pool();
+
+  template <typename F>
+  auto submit(F &&f) -> std::future<decltype(f())> {
+    using result_type = decltype(f());
+    auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(f));
+    auto result = task->get_future();
+    {
+      std::unique_lock<std::mutex> lock(mut_);
+      tasks_.emplace([task]() {
+        (*task)();
+      });
+    }
+    cv_.notify_one();
+    return result;
+  }
+
+private:
+  void worker();
+};
+
+template <typename T>
+bool is_ready(const std::future<T> &f) {
+  return f.valid() && f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+template <typename T>
+bool is_ready(const std::shared_future<T> &f) {
+  return f.valid() && f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
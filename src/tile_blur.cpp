@@ -0,0 +1,197 @@
+#include "tile_blur.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Implemented in blur_float.cpp and blur_compact.cpp
+extern void std_to_box(int boxes[], float sigma, int n);
+extern void fast_gaussian_blur(float *&in, float *&out, int w, int h, float sigma);
+extern void fast_gaussian_blur(uint8_t *&in, uint8_t *&out, int w, int h, float sigma);
+
+void tile_changes::update(const uint8_t *luma, int frame_w, int frame_h, int scale, float sigma) {
+  if (frame_w != frame_w_ || frame_h != frame_h_ || scale != scale_ || sigma != sigma_) {
+    frame_w_ = frame_w;
+    frame_h_ = frame_h;
+    scale_ = scale;
+    sigma_ = sigma;
+    tiles_x_ = (frame_w + tile_size - 1) / tile_size;
+    tiles_y_ = (frame_h + tile_size - 1) / tile_size;
+    blocks_x_ = (frame_w + block - 1) / block;
+    blocks_y_ = (frame_h + block - 1) / block;
+    reference_.resize(blocks_x_ * blocks_y_);
+    current_.resize(blocks_x_ * blocks_y_);
+    row_sums_.resize(frame_w);
+    changed_.resize(tiles_x_ * tiles_y_);
+    dirty_.resize(tiles_x_ * tiles_y_);
+
+    // the three box blurs each spread a pixel by their radius, and a box blur needs at least 2 * radius + 1 pixels
+    int boxes[3];
+    std_to_box(boxes, sigma, 3);
+    apron_ = std::max(boxes[0] + boxes[1] + boxes[2], 2 * std::max({boxes[0], boxes[1], boxes[2]}));
+    valid_ = false;
+  }
+
+  make_thumbnail(luma);
+
+  full_ = !valid_ || ++frames_ >= refresh_frames;
+  if (!full_) {
+    for (int ty = 0; ty < tiles_y_; ty++) {
+      for (int tx = 0; tx < tiles_x_; tx++) changed_[ty * tiles_x_ + tx] = tile_changed(tx, ty);
+    }
+
+    // a changed pixel changes the blurred pixels up to the apron around it, also in the neighbouring tiles
+    const int reach = (apron_ + plane_tile_size() - 1) / plane_tile_size();
+    int count = 0;
+    for (int ty = 0; ty < tiles_y_; ty++) {
+      for (int tx = 0; tx < tiles_x_; tx++) {
+        bool dirty = false;
+        for (int y = std::max(ty - reach, 0); y <= std::min(ty + reach, tiles_y_ - 1) && !dirty; y++) {
+          for (int x = std::max(tx - reach, 0); x <= std::min(tx + reach, tiles_x_ - 1) && !dirty; x++) {
+            dirty = changed_[y * tiles_x_ + x];
+          }
+        }
+        dirty_[ty * tiles_x_ + tx] = dirty;
+        count += dirty;
+      }
+    }
+    // with the aprons blurred over and over, blurring everything is cheaper at this point
+    full_ = count * 2 > tiles_x_ * tiles_y_;
+  }
+
+  if (full_) {
+    std::fill(dirty_.begin(), dirty_.end(), 1);
+    reference_ = current_;
+    frames_ = 0;
+    valid_ = true;
+    return;
+  }
+  for (int ty = 0; ty < tiles_y_; ty++) {
+    for (int tx = 0; tx < tiles_x_; tx++) {
+      if (dirty(tx, ty)) keep_tile(tx, ty);
+    }
+  }
+}
+
+void tile_changes::make_thumbnail(const uint8_t *luma) {
+  // average each block of the frame into one thumbnail pixel (kept as 8.8 fixed-point for precision)
+  for (int by = 0; by < blocks_y_; by++) {
+    const int y0 = by * block, y1 = std::min(y0 + block, frame_h_);
+    std::fill(row_sums_.begin(), row_sums_.end(), 0);
+    for (int y = y0; y < y1; y++) {
+      const uint8_t *row = luma + y * frame_w_;
+      for (int x = 0; x < frame_w_; x++) row_sums_[x] += row[x];
+    }
+    for (int bx = 0; bx < blocks_x_; bx++) {
+      const int x0 = bx * block, x1 = std::min(x0 + block, frame_w_);
+      uint32_t sum = 0;
+      for (int x = x0; x < x1; x++) sum += row_sums_[x];
+      current_[by * blocks_x_ + bx] = uint16_t((sum << 8) / ((x1 - x0) * (y1 - y0)));
+    }
+  }
+}
+
+bool tile_changes::tile_changed(int tx, int ty) const {
+  // any block that changed, a moving hand is small compared to a tile
+  const int per_tile = tile_size / block;
+  const int limit = int(threshold * 256);
+  const int bx1 = std::min((tx + 1) * per_tile, blocks_x_), by1 = std::min((ty + 1) * per_tile, blocks_y_);
+  for (int by = ty * per_tile; by < by1; by++) {
+    for (int bx = tx * per_tile; bx < bx1; bx++) {
+      const int i = by * blocks_x_ + bx;
+      if (std::abs(int(current_[i]) - int(reference_[i])) > limit) return true;
+    }
+  }
+  return false;
+}
+
+void tile_changes::keep_tile(int tx, int ty) {
+  const int per_tile = tile_size / block;
+  const int bx0 = tx * per_tile, bx1 = std::min(bx0 + per_tile, blocks_x_);
+  const int by1 = std::min((ty + 1) * per_tile, blocks_y_);
+  for (int by = ty * per_tile; by < by1; by++) {
+    std::copy(current_.begin() + by * blocks_x_ + bx0,
+              current_.begin() + by * blocks_x_ + bx1,
+              reference_.begin() + by * blocks_x_ + bx0);
+  }
+}
+
+namespace {
+
+template <typename T>
+void blur_tiles(const tile_changes &changes,
+                T *plane,
+                int w,
+                int h,
+                float sigma,
+                std::vector<T> &blurred,
+                std::vector<T> &tile,
+                std::vector<T> &tile_scratch) {
+  blurred.resize(size_t(w) * h);
+  if (changes.full()) {
+    tile_scratch.resize(size_t(w) * h);
+    T *in = plane;
+    T *out = tile_scratch.data();
+    fast_gaussian_blur(in, out, w, h, sigma);
+    std::copy(plane, plane + size_t(w) * h, blurred.data());
+    return;
+  }
+
+  const int size = changes.plane_tile_size();
+  const int apron = changes.apron();
+  for (int ty = 0; ty < changes.tiles_y() && ty * size < h; ty++) {
+    const int y0 = ty * size, y1 = std::min(y0 + size, h);
+    for (int tx = 0; tx < changes.tiles_x() && tx * size < w;) {
+      if (!changes.dirty(tx, ty)) {
+        tx++;
+        continue;
+      }
+      // blur the whole run of dirty tiles in this row at once, the apron only has to be blurred once
+      int end = tx;
+      while (end < changes.tiles_x() && changes.dirty(end, ty)) end++;
+      const int x0 = tx * size, x1 = std::min(end * size, w);
+      tx = end;
+
+      const int rx0 = std::max(x0 - apron, 0), rx1 = std::min(x1 + apron, w);
+      const int ry0 = std::max(y0 - apron, 0), ry1 = std::min(y1 + apron, h);
+      const int rw = rx1 - rx0, rh = ry1 - ry0;
+      tile.resize(size_t(rw) * rh);
+      tile_scratch.resize(size_t(rw) * rh);
+      for (int y = ry0; y < ry1; y++) {
+        std::copy(plane + size_t(y) * w + rx0, plane + size_t(y) * w + rx1, tile.data() + size_t(y - ry0) * rw);
+      }
+      T *in = tile.data();
+      T *out = tile_scratch.data();
+      fast_gaussian_blur(in, out, rw, rh, sigma);
+      // the result is in `tile`
+      for (int y = y0; y < y1; y++) {
+        const T *src = tile.data() + size_t(y - ry0) * rw + (x0 - rx0);
+        std::copy(src, src + (x1 - x0), blurred.data() + size_t(y) * w + x0);
+      }
+    }
+  }
+  std::copy(blurred.begin(), blurred.end(), plane);
+}
+
+}  // namespace
+
+void blur_changed_tiles(const tile_changes &changes,
+                        float *plane,
+                        int w,
+                        int h,
+                        float sigma,
+                        std::vector<float> &blurred,
+                        std::vector<float> &tile,
+                        std::vector<float> &tile_scratch) {
+  blur_tiles(changes, plane, w, h, sigma, blurred, tile, tile_scratch);
+}
+
+void blur_changed_tiles(const tile_changes &changes,
+                        uint8_t *plane,
+                        int w,
+                        int h,
+                        float sigma,
+                        std::vector<uint8_t> &blurred,
+                        std::vector<uint8_t> &tile,
+                        std::vector<uint8_t> &tile_scratch) {
+  blur_tiles(changes, plane, w, h, sigma, blurred, tile, tile_scratch);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Tiles of the frame whose content changed since they were last blurred, for the incremental background blur.
+// A webcam background is mostly static apart from the person and sensor noise, so the blurred background of the
+// previous frames is kept and only the changed tiles (and the tiles within the blur radius around them) are blurred
+// again. Changes are detected on a luma thumbnail of 8x8 pixel blocks, compared against the thumbnail of each tile when
+// it was last blurred, so slow drifts are caught up with as well. Everything is blurred again every `refresh_frames`
+// frames, and whenever most of the tiles changed anyway.
+class tile_changes {
+public:
+  static constexpr int tile_size = 32;  // tile side in frame pixels
+
+private:
+  static constexpr int block = 8;  // thumbnail block side in frame pixels
+
+  int frame_w_ = 0;
+  int frame_h_ = 0;
+  int scale_ = 0;
+  float sigma_ = 0;
+  int apron_ = 0;  // pixels around a tile (at blur resolution) that contribute to its blurred pixels
+  int tiles_x_ = 0;
+  int tiles_y_ = 0;
+  int blocks_x_ = 0;
+  int blocks_y_ = 0;
+  int frames_ = 0;
+  bool valid_ = false;
+  bool full_ = true;
+
+  std::vector<uint16_t> reference_;  // thumbnail (8.8 fixed-point) of each tile when it was last blurred
+  std::vector<uint16_t> current_;
+  std::vector<uint32_t> row_sums_;
+  std::vector<uint8_t> changed_;
+  std::vector<uint8_t> dirty_;
+
+public:
+  float threshold = 4.f;     // luma difference of a block that counts as a change, well above the sensor noise
+  int refresh_frames = 150;  // frames between full blurs
+
+  // Forgets the blurred background, the next update blurs everything
+  void invalidate() {
+    valid_ = false;
+  }
+
+  // Finds the tiles to blur for this frame. The planes are blurred at 1/scale of the frame resolution with `sigma`
+  // (in pixels of that resolution), changing either also blurs everything.
+  void update(const uint8_t *luma, int frame_w, int frame_h, int scale, float sigma);
+
+  bool full() const {
+    return full_;
+  }
+  int tiles_x() const {
+    return tiles_x_;
+  }
+  int tiles_y() const {
+    return tiles_y_;
+  }
+  bool dirty(int tx, int ty) const {
+    return dirty_[ty * tiles_x_ + tx];
+  }
+  // tile side and apron at blur resolution
+  int plane_tile_size() const {
+    return tile_size / scale_;
+  }
+  int apron() const {
+    return apron_;
+  }
+
+private:
+  void make_thumbnail(const uint8_t *luma);
+  bool tile_changed(int tx, int ty) const;
+  void keep_tile(int tx, int ty);
+};
+
+// Blurs a background plane (w x h, at the resolution given to tile_changes::update) like fast_gaussian_blur, but only
+// the dirty tiles: the other ones are taken from `blurred`, the result of the previous calls for this plane. Each run
+// of dirty tiles is blurred with its apron, so it comes out the same as blurring the full plane. The result ends up in
+// `plane` and in `blurred`, `tile` and `tile_scratch` are scratch space.
+void blur_changed_tiles(const tile_changes &changes,
+                        float *plane,
+                        int w,
+                        int h,
+                        float sigma,
+                        std::vector<float> &blurred,
+                        std::vector<float> &tile,
+                        std::vector<float> &tile_scratch);
+void blur_changed_tiles(const tile_changes &changes,
+                        uint8_t *plane,
+                        int w,
+                        int h,
+                        float sigma,
+                        std::vector<uint8_t> &blurred,
+                        std::vector<uint8_t> &tile,
+                        std::vector<uint8_t> &tile_scratch);
@@ -5,6 +5,8 @@
 
 #include <stdio.h>
 
+#include "colour.hpp"
+
 int main(int argc, char *argv[])
 {
     if (argc != 3) {
@@ -29,22 +31,9 @@ int main(int argc, char *argv[])
     }
     std::cout << "size = " << size << " / " << buffer.size() << std::endl;
 
-    for (size_t i=0; i<size; i+=4) {
-        uint8_t& a = *((uint8_t *)(&buffer[i  ]));
-        uint8_t& y = *((uint8_t *)(&buffer[i+1]));
-        uint8_t& u = *((uint8_t *)(&buffer[i+2]));
-        uint8_t& v = *((uint8_t *)(&buffer[i+3]));
-
-        uint8_t r  = y +                       + (v - 128) *  1.40200;
-        uint8_t g  = y + (u - 128) * -0.34414 + (v - 128) * -0.71414;
-        uint8_t b  = y + (u - 128) *  1.77200;
-        uint8_t a2 = a;
-
-        a = r;
-        y = g;
-        u = b;
-        v = a2;
-    }
+    // same colours as the background in the camera stream (AYUV -> RGBA, in place)
+    uint8_t *pixels = (uint8_t *)buffer.data();
+    camera_colour::ayuv_to_rgba(pixels, pixels, size / 4);
 
     std::ofstream file_out(output, std::ios::binary);
     file_out.write((char *)&buffer[0], buffer.size() * sizeof(char));
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "colour.hpp"
+#include "simd.h"
+
+// Converts whole frame sequences (animated backgrounds) in one go: every core converts frames, the conversion loops are
+// compiled for every instruction set (see simd.h), and files are read and written through memory mappings.
+
+namespace {
+
+PIXEL_KERNEL void rgba_to_ayuv(const uint8_t *in, uint8_t *out, size_t pixels)
+{
+    camera_colour::rgba_to_ayuv(in, out, pixels);
+}
+
+PIXEL_KERNEL void ayuv_to_rgba(const uint8_t *in, uint8_t *out, size_t pixels)
+{
+    camera_colour::ayuv_to_rgba(in, out, pixels);
+}
+
+// A file mapped into memory, read-only or created with a given size
+class mapped_file {
+private:
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+
+public:
+    bool open_read(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size_ = size_t(st.st_size);
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) return false;
+        data_ = static_cast<uint8_t *>(data);
+        madvise(data_, size_, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    bool create(const std::string &path, size_t size)
+    {
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, off_t(size)) != 0) {
+            close(fd);
+            return false;
+        }
+        size_ = size;
+        void *data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) return false;
+        data_ = static_cast<uint8_t *>(data);
+        return true;
+    }
+
+    ~mapped_file()
+    {
+        if (data_) munmap(data_, size_);
+    }
+
+    uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+// Runs f(0) .. f(n - 1) on `threads` threads
+template <typename F>
+void parallel_for(size_t n, int threads, F f)
+{
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (size_t i; (i = next++) < n;) f(i);
+        });
+    }
+    for (auto &worker : workers) worker.join();
+}
+
+// Frame files in numeric order (2.data before 10.data) when their names are numbers
+bool frame_order(const std::string &a, const std::string &b)
+{
+    const std::string stem_a = std::filesystem::path(a).stem().string();
+    const std::string stem_b = std::filesystem::path(b).stem().string();
+    const auto numeric = [](const std::string &s) {
+        return !s.empty() && std::all_of(s.begin(), s.end(), ::isdigit);
+    };
+    if (numeric(stem_a) && numeric(stem_b) && stem_a.size() != stem_b.size()) {
+        return stem_a.size() < stem_b.size();
+    }
+    return a < b;
+}
+
+std::vector<std::string> input_files(const std::string &input)
+{
+    std::vector<std::string> files;
+    if (std::filesystem::is_directory(input)) {
+        for (const auto &entry : std::filesystem::directory_iterator(input)) {
+            if (entry.is_regular_file()) files.push_back(entry.path().string());
+        }
+    } else {
+        glob_t matches;
+        if (glob(input.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) files.push_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+    }
+    std::sort(files.begin(), files.end(), frame_order);
+    return files;
+}
+
+void usage(const char *name)
+{
+    std::cerr << "usage: ./" << name << " [options] <input> <output>" << std::endl;
+    std::cerr << "   ex: ./" << name << " frames/ ../backgrounds/spaceship" << std::endl;
+    std::cerr << "   ex: ./" << name << " -p 'frames/*.data' ../backgrounds/spaceship.ayuv" << std::endl;
+    std::cerr << "   ex: ffmpeg -i clip.mp4 -vf scale=640:480 -f rawvideo -pix_fmt rgba - | ./" << name
+              << " -s 640x480 - ../backgrounds/clip" << std::endl;
+    std::cerr << "" << std::endl;
+    std::cerr << "input:  a directory or a (quoted) glob of RGBA8888 raw frame files, or - for raw frames on stdin."
+              << std::endl;
+    std::cerr << "output: a directory, that gets a 0.ayuv, 1.ayuv, .. file per frame (like the spaceship background)."
+              << std::endl;
+    std::cerr << "options:" << std::endl;
+    std::cerr << "  -s WxH  frame size, needed for stdin" << std::endl;
+    std::cerr << "  -p      write a single file with all frames one after the other instead" << std::endl;
+    std::cerr << "  -r      reverse: AYUV8888 frames to RGBA8888 (.data) frames" << std::endl;
+    std::cerr << "  -j N    number of threads (default: all cores)" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    bool pack = false;
+    bool reverse = false;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t width = 0, height = 0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-p") {
+            pack = true;
+        } else if (arg == "-r") {
+            reverse = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-s" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%zux%zu", &width, &height) != 2) width = height = 0;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    const std::string input = args[0];
+    const std::string output = args[1];
+    const auto convert = reverse ? ayuv_to_rgba : rgba_to_ayuv;
+    const std::string extension = reverse ? ".data" : ".ayuv";
+    if (!pack) {
+        std::filesystem::create_directories(output);
+    }
+    const auto frame_path = [&](size_t i) {
+        return output + "/" + std::to_string(i) + extension;
+    };
+
+    const auto begin = std::chrono::steady_clock::now();
+    std::atomic<bool> failed{false};
+    size_t frames = 0;
+
+    if (input == "-") {
+        // frames from a pipe cannot be mapped, they are read in batches of a few frames per thread and converted in
+        // place
+        if (width == 0 || height == 0) {
+            std::cerr << "stdin needs the frame size (-s WxH)." << std::endl;
+            return 1;
+        }
+        const size_t frame_bytes = width * height * 4;
+        const size_t batch = size_t(threads) * 4;
+        std::vector<uint8_t> buffer(batch * frame_bytes);
+        FILE *packed = pack ? fopen(output.c_str(), "wb") : nullptr;
+        if (pack && !packed) {
+            std::cerr << "Cannot create " << output << std::endl;
+            return 1;
+        }
+        size_t partial = 0;
+        while (!failed) {
+            // read as bytes, so that a frame cut off at the end of the input is noticed
+            const size_t bytes = fread(buffer.data(), 1, buffer.size(), stdin);
+            const size_t count = bytes / frame_bytes;
+            partial = bytes % frame_bytes;
+            if (count == 0) break;
+            parallel_for(count, threads, [&](size_t i) {
+                uint8_t *frame = buffer.data() + i * frame_bytes;
+                if (pack) {
+                    convert(frame, frame, width * height);
+                    return;
+                }
+                mapped_file out;
+                if (!out.create(frame_path(frames + i), frame_bytes)) {
+                    std::cerr << "Cannot create " << frame_path(frames + i) << std::endl;
+                    failed = true;
+                    return;
+                }
+                convert(frame, out.data(), width * height);
+            });
+            if (packed && fwrite(buffer.data(), frame_bytes, count, packed) != count) failed = true;
+            frames += count;
+            if (bytes < buffer.size()) break;
+        }
+        if (packed && fclose(packed) != 0) failed = true;
+        if (ferror(stdin)) {
+            std::cerr << "Cannot read stdin" << std::endl;
+            return 1;
+        }
+        if (partial != 0) {
+            std::cerr << "stdin ended " << partial << " bytes into frame " << frames << " (" << frame_bytes
+                      << " bytes per frame), does -s " << width << "x" << height << " match the input?" << std::endl;
+            return 1;
+        }
+    } else {
+        const std::vector<std::string> files = input_files(input);
+        if (files.empty()) {
+            std::cerr << "No frames found: " << input << std::endl;
+            return 1;
+        }
+        frames = files.size();
+        // packed frames all need the size of the first one
+        size_t frame_bytes = 0;
+        mapped_file packed;
+        if (pack) {
+            mapped_file first;
+            if (!first.open_read(files[0])) {
+                std::cerr << "Reading file failed: " << files[0] << std::endl;
+                return 1;
+            }
+            frame_bytes = first.size();
+            if (!packed.create(output, frame_bytes * frames)) {
+                std::cerr << "Cannot create " << output << std::endl;
+                return 1;
+            }
+        }
+        parallel_for(frames, threads, [&](size_t i) {
+            mapped_file in;
+            if (!in.open_read(files[i]) || in.size() % 4 != 0 || (pack && in.size() != frame_bytes)) {
+                std::cerr << "Skipping " << files[i] << ": cannot read it, or not a frame of the right size."
+                          << std::endl;
+                failed = true;
+                return;
+            }
+            if (pack) {
+                convert(in.data(), packed.data() + i * frame_bytes, in.size() / 4);
+                return;
+            }
+            mapped_file out;
+            if (!out.create(frame_path(i), in.size())) {
+                std::cerr << "Cannot create " << frame_path(i) << std::endl;
+                failed = true;
+                return;
+            }
+            convert(in.data(), out.data(), in.size() / 4);
+        });
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << frames << " frames in " << seconds << " s (" << (frames / seconds) << " frames/s, " << threads
+              << " threads)" << std::endl;
+    return failed ? 1 : 0;
+}
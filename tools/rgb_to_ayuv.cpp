@@ -5,6 +5,8 @@
 
 #include <stdio.h>
 
+#include "colour.hpp"
+
 int main(int argc, char *argv[])
 {
     if (argc != 3) {
@@ -32,25 +34,9 @@ int main(int argc, char *argv[])
     }
     std::cout << "size = " << size << " / " << buffer.size() << std::endl;
 
-    for (size_t i=0; i<size; i+=4) {
-        uint8_t& r = *((uint8_t *)(&buffer[i  ]));
-        uint8_t& g = *((uint8_t *)(&buffer[i+1]));
-        uint8_t& b = *((uint8_t *)(&buffer[i+2]));
-        uint8_t& a = *((uint8_t *)(&buffer[i+3]));
-
-        uint8_t y = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
-        uint8_t u = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
-        uint8_t v = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
-        uint8_t a2 = a;
-
-        // printf("ARGB: %d, %d, %d, %d\n", a, r, g, b);
-        // printf("AYUV: %d, %d, %d, %d\n", a, y, u, v);
-
-        r = a2;
-        g = y;
-        b = u;
-        a = v;
-    }
+    // same conversion as the backgrounds loaded by the app (RGBA -> AYUV, in place)
+    uint8_t *pixels = (uint8_t *)buffer.data();
+    camera_colour::rgba_to_ayuv(pixels, pixels, size / 4);
 
     std::ofstream file_out(output, std::ios::binary);
     file_out.write((char *)&buffer[0], buffer.size() * sizeof(char));
@@ -5,6 +5,8 @@
 
 #include <stdio.h>
 
+#include "colour.hpp"
+
 int main(int argc, char *argv[])
 {
     if (argc != 3) {
@@ -25,7 +27,7 @@ int main(int argc, char *argv[])
     file.seekg(0, std::ios::beg);
 
     std::vector<char> buffer(size);
-    std::vector<char> buffer_out;
+    std::vector<char> buffer_out(size / 4 * 3);
     std::cout << "size = " << size << " / " << buffer.size() << std::endl;
     if (!file.read(buffer.data(), size)) {
         std::cerr << "Reading file failed." << std::endl;
@@ -33,21 +35,7 @@ int main(int argc, char *argv[])
     }
     std::cout << "size = " << size << " / " << buffer.size() << std::endl;
 
-    for (size_t i=0; i<size; i+=4) {
-        uint8_t& r = *((uint8_t *)(&buffer[i  ]));
-        uint8_t& g = *((uint8_t *)(&buffer[i+1]));
-        uint8_t& b = *((uint8_t *)(&buffer[i+2]));
-        uint8_t& a = *((uint8_t *)(&buffer[i+3]));
-
-        uint8_t y = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
-        uint8_t u = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
-        uint8_t v = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
-        uint8_t a2 = a;
-
-        buffer_out.push_back(y);
-        buffer_out.push_back(u);
-        buffer_out.push_back(v);
-    }
+    camera_colour::rgba_to_yuv((const uint8_t *)buffer.data(), (uint8_t *)buffer_out.data(), size / 4);
 
     std::ofstream file_out(output, std::ios::binary);
     file_out.write((char *)&buffer_out[0], buffer_out.size() * sizeof(char));
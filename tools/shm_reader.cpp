@@ -0,0 +1,145 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_ring.h"
+
+// Reads the frames the app publishes in shared memory (set-shm on), and reports frame rate, latency and skipped
+// frames. With -w it publishes a test pattern itself, so both sides can be tried without a camera.
+
+namespace {
+
+void usage(const char *name)
+{
+    std::cerr << "usage: ./" << name << " [options] [name]" << std::endl;
+    std::cerr << "   ex: ./" << name << " /webcamvb-video9" << std::endl;
+    std::cerr << "   ex: ./" << name << " -n 300 -o frames.yuv" << std::endl;
+    std::cerr << "" << std::endl;
+    std::cerr << "name: shared memory of the stream (default: /webcamvb-video9, for output /dev/video9)" << std::endl;
+    std::cerr << "options:" << std::endl;
+    std::cerr << "  -n N  stop after N frames" << std::endl;
+    std::cerr << "  -o F  write the frames to F, play with: ffplay -f rawvideo -pixel_format yuv420p -video_size WxH F"
+              << std::endl;
+    std::cerr << "  -m F  write the masks to F, play with: ffplay -f rawvideo -pixel_format gray -video_size WxH F"
+              << std::endl;
+    std::cerr << "  -w    publish a moving 640x480 test pattern with masks at 30 fps instead of reading" << std::endl;
+}
+
+int write_test_pattern(const std::string &name, long frames)
+{
+    const int w = 640, h = 480;
+    shm_ring_writer ring;
+    if (!ring.open(name, w, h, true)) {
+        return 1;
+    }
+    std::cout << "publishing to " << name << std::endl;
+    std::vector<uint8_t> frame(w * h * 3 / 2);
+    std::vector<float> mask(w * h);
+    auto next = std::chrono::steady_clock::now();
+    for (long n = 0; frames == 0 || n < frames; n++) {
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                frame[y * w + x] = uint8_t(x + y + n * 4);
+                const int dx = x - (int(n * 4) % w), dy = y - h / 2;
+                mask[y * w + x] = dx * dx + dy * dy < 100 * 100 ? 1.f : 0.f;
+            }
+        }
+        std::fill(frame.begin() + w * h, frame.end(), 128);
+        ring.publish(frame.data(), n, mask.data());
+        next += std::chrono::microseconds(33333);
+        std::this_thread::sleep_until(next);
+    }
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string name = "/webcamvb-video9";
+    long frames = 0;
+    bool write = false;
+    FILE *frames_out = nullptr;
+    FILE *masks_out = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if ((arg == "-o" || arg == "-m") && i + 1 < argc) {
+            FILE *&out = arg == "-o" ? frames_out : masks_out;
+            out = fopen(argv[++i], "wb");
+            if (!out) {
+                std::cerr << "Cannot create " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "-w") {
+            write = true;
+        } else if (arg[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            name = arg;
+        }
+    }
+    if (write) {
+        return write_test_pattern(name, frames);
+    }
+
+    shm_ring_reader ring;
+    std::vector<uint8_t> copy;
+    long count = 0, skipped = 0, torn = 0, window = 0;
+    double latency_ms = 0;
+    uint64_t previous = 0;
+    auto report = std::chrono::steady_clock::now();
+    while (frames == 0 || count < frames) {
+        if (ring.closed()) {
+            if (!ring.open(name)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                continue;
+            }
+            std::cout << "reading " << name << ": " << ring.width() << "x" << ring.height()
+                      << (ring.has_masks() ? " with masks" : "") << std::endl;
+            previous = 0;
+        }
+        shm_frame frame;
+        if (!ring.next(frame, 1000)) {
+            continue;
+        }
+        // frames are read in place, copied only to write them out
+        const size_t frame_bytes = size_t(ring.width()) * ring.height() * 3 / 2;
+        const size_t mask_bytes = frame.mask ? size_t(ring.width()) * ring.height() : 0;
+        if (frames_out || masks_out) {
+            copy.assign(frame.yuv, frame.yuv + frame_bytes);
+            if (frame.mask) copy.insert(copy.end(), frame.mask, frame.mask + mask_bytes);
+        }
+        if (!ring.intact(frame)) {
+            torn++;
+            continue;
+        }
+        if (frames_out) fwrite(copy.data(), 1, frame_bytes, frames_out);
+        if (masks_out && frame.mask) fwrite(copy.data() + frame_bytes, 1, mask_bytes, masks_out);
+
+        latency_ms += (monotonic_ns() - frame.time_ns) / 1e6;
+        if (previous != 0) skipped += long(frame.sequence - previous - 1);
+        previous = frame.sequence;
+        count++;
+        window++;
+
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - report).count();
+        if (seconds >= 1.) {
+            std::cout << "frame " << frame.sequence << ": " << (window / seconds) << " fps, latency "
+                      << (latency_ms / window) << " ms, skipped " << skipped << ", overwritten while read " << torn
+                      << std::endl;
+            report = now;
+            window = 0;
+            latency_ms = 0;
+        }
+    }
+    if (frames_out) fclose(frames_out);
+    if (masks_out) fclose(masks_out);
+    return 0;
+}